@@ -0,0 +1,329 @@
+/*
+  headless conio for the native build of ned, and the bench that goes
+  with it.
+
+  the keys are read from a script on stdin: chars stand for themselves,
+  ^X is Ctrl/X, {name} a key by name (see keynames[]) or a single char,
+  {n*keys} the keys in the braces n times. newlines are left out, so is
+  a line starting with #. {ahead} makes the keys after it wait in the
+  keyboard buffer, as if typed ahead or pasted, {wait} goes back to one
+  key at a time.
+
+  the editor quits when the script runs out, and prints for each key the
+  times it was pressed, the time and the TRACE() counts from it up to the
+  next key. a key following Ctrl/V is counted as its own command, all
+  printable keys as text.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include "conio.h"
+
+#define LINES 25
+#define COLS  40
+
+#define MAXKEYS  (1L<<20)
+#define MAXNAMES 128
+#define SHIFTKEY 22             /* Ctrl/V, as in main.c */
+
+unsigned char hostscr[LINES*COLS];
+unsigned char hostcol[LINES*COLS];
+
+static unsigned char curx, cury, rev;
+
+static unsigned char *keys, *ahead;
+static long nkeys, keypos = -1;
+
+unsigned long benchwork[MAXNAMES];
+static const char *names[MAXNAMES];
+static int nnames;
+
+// count, time in ns and work done per command, shifted ones from 256
+static unsigned long cmdcount[512];
+static unsigned long long cmdtime[512];
+static unsigned long cmdwork[512][MAXNAMES];
+static int cmd = -1;
+static struct timespec cmdstart;
+
+static const struct {
+	const char *name;
+	unsigned char key;
+} keynames[] = {
+	{ "up",    CH_CURS_UP },
+	{ "down",  CH_CURS_DOWN },
+	{ "left",  CH_CURS_LEFT },
+	{ "right", CH_CURS_RIGHT },
+	{ "del",   CH_DEL },
+	{ "ins",   CH_INS },
+	{ "cr",    13 },
+	{ "tab",   9 },
+	{ "space", ' ' },
+	{ "shift", SHIFTKEY },
+	{ 0, 0 }
+};
+
+/*
+  screen
+*/
+
+void gotoxy(unsigned char x, unsigned char y)
+{
+	curx = x;
+	cury = y;
+}
+
+unsigned char wherex(void)
+{
+	return curx;
+}
+
+unsigned char wherey(void)
+{
+	return cury;
+}
+
+// put screen code c at the cursor and move it on
+static void scrput(unsigned char c)
+{
+	if((cury < LINES) && (curx < COLS)) hostscr[cury*COLS+curx] = c | (rev ? 0x80 : 0);
+	if(++curx >= COLS) {
+		curx = 0;
+		++cury;
+	}
+}
+
+// same conversion from PETSCII to screen codes as cc65's cputc()
+void cputc(char ch)
+{
+	unsigned char c = ch;
+
+	if(c == '\n') curx = 0;
+	else if(c == '\r') {
+		curx = 0;
+		++cury;
+	} else if(c < 0x20) scrput(c);
+	else if(c < 0x80) scrput((c >= 0x60) ? (c & 0xdf) : (c & 0x3f));
+	else if((c &= 0x7f) == 0x7f) scrput(0x5e | 0x40);
+	else scrput(c | 0x40);
+}
+
+void cputs(const char *s)
+{
+	while(*s) cputc(*s++);
+}
+
+int cprintf(const char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	cputs(buf);
+	return n;
+}
+
+void cclear(unsigned char n)
+{
+	while(n--) scrput(' ');
+}
+
+unsigned char revers(unsigned char onoff)
+{
+	unsigned char o = rev;
+
+	rev = onoff;
+	return o;
+}
+
+/*
+  bench
+*/
+
+int benchname(const char *name)
+{
+	int i;
+
+	// the same name can be traced in more than one place
+	for(i = 1; i <= nnames; ++i) if(!strcmp(names[i], name)) return i;
+	if(nnames >= (MAXNAMES-1)) return 0;
+	names[++nnames] = name;
+	return nnames;
+}
+
+static unsigned long long nsecs(struct timespec *a, struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1000000000ULL + b->tv_nsec - a->tv_nsec;
+}
+
+// the command running up to now is done, book its time and work
+static void cmddone(void)
+{
+	struct timespec now;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if(cmd >= 0) {
+		++cmdcount[cmd];
+		cmdtime[cmd] += nsecs(&cmdstart, &now);
+		for(i = 1; i <= nnames; ++i) cmdwork[cmd][i] += benchwork[i];
+	}
+	memset(benchwork, 0, sizeof(benchwork));
+	cmdstart = now;
+}
+
+static const char *keylabel(int c)
+{
+	static char buf[16];
+	int i;
+
+	for(i = 0; keynames[i].name; ++i)
+		if(keynames[i].key == (c & 0xff)) break;
+	if(keynames[i].name) sprintf(buf, "%s", keynames[i].name);
+	else if((c & 0xff) < 0x20) sprintf(buf, "^%c", (c & 0xff) + '@');
+	else if(((c & 0xff) < 0x7f) && (c & 0x100)) sprintf(buf, "%c", c & 0xff);
+	else if((c & 0xff) < 0x7f) sprintf(buf, "text");
+	else sprintf(buf, "#%d", c & 0xff);
+	if(c & 0x100) {
+		memmove(buf + 6, buf, strlen(buf) + 1);
+		memcpy(buf, "shift ", 6);
+	}
+	return buf;
+}
+
+static void report(void)
+{
+	unsigned long long total = 0;
+	unsigned long n = 0;
+	int c, j, best;
+	unsigned long w;
+	char done[MAXNAMES];
+
+	cmddone();
+	cmd = -1;
+	printf("\n%-10s %7s %11s %9s  %s\n", "key", "count", "usec", "usec/key", "work");
+	for(c = 0; c < 512; ++c) {
+		if(!cmdcount[c]) continue;
+		n += cmdcount[c];
+		total += cmdtime[c];
+		printf("%-10s %7lu %11.1f %9.2f ", keylabel(c), cmdcount[c],
+		       cmdtime[c] / 1000.0, cmdtime[c] / 1000.0 / cmdcount[c]);
+		// the calls per function, most first
+		memset(done, 0, sizeof(done));
+		for(;;) {
+			for(best = 0, w = 0, j = 1; j <= nnames; ++j)
+				if(!done[j] && (cmdwork[c][j] > w)) w = cmdwork[c][best = j];
+			if(!best) break;
+			done[best] = 1;
+			printf(" %s %lu", names[best], w);
+		}
+		printf("\n");
+	}
+	printf("%-10s %7lu %11.1f\n", "total", n, total / 1000.0);
+}
+
+/*
+  keys
+*/
+
+static int keywait = 1;          // keys come one at a time, not typed ahead
+
+// add the keys of script s..e to keys[]
+static void addkeys(const char *s, const char *e)
+{
+	static char name[32];
+	const char *p, *q;
+	int c, i, n, depth, bol = 1;
+
+	while((s < e) && (nkeys < MAXKEYS)) {
+		c = (unsigned char)*s++;
+		if((c == '#') && bol) {
+			while((s < e) && (*s != '\n')) ++s;
+			continue;
+		}
+		if((bol = ((c == '\n') || (c == '\r')))) continue;
+		n = 1;
+		if((c == '^') && (s < e)) c = *s++ & 0x1f;
+		else if(c == '{') {
+			// find the closing brace, {n*...} can hold more keys
+			for(p = s, depth = 0; (p < e) && ((*p != '}') || (p == s) || depth); ++p) {
+				if(p == s) continue;
+				if(*p == '{') ++depth;
+				else if(*p == '}') --depth;
+			}
+			if(p >= e) break;
+			q = s;
+			if(atoi(s) && (q = memchr(s, '*', p - s))) {
+				n = atoi(s);
+				++q;
+			} else q = s;
+			s = p + 1;
+			i = p - q;
+			if(i >= (int)sizeof(name)) i = 0;
+			memcpy(name, q, i);
+			name[i] = 0;
+			if(!strcmp(name, "ahead") || !strcmp(name, "wait")) {
+				keywait = (name[0] == 'w');
+				continue;
+			}
+			for(i = 0; keynames[i].name; ++i)
+				if(!strcmp(keynames[i].name, name)) break;
+			if(keynames[i].name) c = keynames[i].key;
+			else if((p - q) == 1) c = (unsigned char)*q;
+			else if(n > 1) {
+				// keys repeated
+				for(; n; --n) addkeys(q, p);
+				continue;
+			} else {
+				fprintf(stderr, "unknown key {%.*s}\n", (int)(p - q), q);
+				exit(1);
+			}
+		}
+		for(; n && (nkeys < MAXKEYS); --n) {
+			ahead[nkeys] = !keywait;
+			keys[nkeys++] = c;
+		}
+	}
+}
+
+// read the key script from stdin, see the top of the file
+static void loadkeys(void)
+{
+	static char script[1L<<16];
+	size_t n;
+
+	keys = malloc(MAXKEYS);
+	ahead = malloc(MAXKEYS);
+	if(!keys || !ahead) exit(1);
+	n = fread(script, 1, sizeof(script), stdin);
+	nkeys = 0;
+	addkeys(script, script + n);
+	keypos = 0;
+	atexit(report);
+	clock_gettime(CLOCK_MONOTONIC, &cmdstart);
+}
+
+unsigned char kbhit(void)
+{
+	if(keypos < 0) loadkeys();
+	return (keypos < nkeys) && ahead[keypos];
+}
+
+char cgetc(void)
+{
+	unsigned char k;
+
+	if(keypos < 0) loadkeys();
+	if(keypos >= nkeys) exit(0);
+	cmddone();
+	k = keys[keypos++];
+	cmd = k;
+	if((keypos > 1) && (keys[keypos-2] == SHIFTKEY) && (k != SHIFTKEY)) cmd |= 0x100;
+	else if((k > ' ') && (k < 0x7f)) cmd = 'a';
+	return k;
+}
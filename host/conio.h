@@ -0,0 +1,45 @@
+/*
+  conio for the native build of ned: just what main.c uses of the cc65
+  conio, on a screen kept in memory instead of the C64's. keys come from
+  a script on stdin (see conio.c), so the editor runs headless and the
+  bench target can replay the same edits on any file. cycles.c uses it
+  for the sim65 build, where there is no conio at all.
+*/
+
+#ifndef CONIO_H
+#define CONIO_H
+
+#ifndef __CC65__
+#define __fastcall__
+#endif
+
+// key codes as the C64 sends them
+#ifndef CH_CURS_UP
+#define CH_CURS_UP    145
+#define CH_CURS_DOWN  17
+#define CH_CURS_LEFT  157
+#define CH_CURS_RIGHT 29
+#define CH_DEL        20
+#define CH_INS        148
+#endif
+
+// screen and color RAM of the shim, main.c writes them directly
+extern unsigned char hostscr[25*40];
+extern unsigned char hostcol[25*40];
+
+void gotoxy(unsigned char x, unsigned char y);
+unsigned char wherex(void);
+unsigned char wherey(void);
+void cputc(char c);
+void cputs(const char *s);
+int cprintf(const char *fmt, ...);
+void cclear(unsigned char n);
+unsigned char revers(unsigned char onoff);
+unsigned char kbhit(void);
+char cgetc(void);
+
+// work counters for TRACE() with -DBENCH
+extern unsigned long benchwork[];
+int benchname(const char *name);
+
+#endif
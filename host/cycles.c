@@ -0,0 +1,131 @@
+/*
+  6502 cycles of the editor's hot paths, under sim65, the simulator that
+  comes with cc65:
+	cl65 -Osir -t sim6502 host/cycles.c -o host/cycles.sim
+	sim65 -c host/cycles.sim corpus op n
+  loads the corpus, then does op n times. sim65 -c prints the cycles of
+  the whole run, so the ones for n = 0 are the loading and setup, and
+  the difference to those over n is what one op costs, loop included.
+  make cycles does that for all ops, with the same corpus every time.
+
+  the screen is an array in memory (SCRRAM in main.c), conio is stubbed
+  out, there is none for sim6502.
+*/
+
+// main.c includes cc65's conio.h, ours stands in for it
+#include "conio.h"
+#define _CONIO_H
+
+#define main nedmain
+#include "../main.c"
+#undef main
+
+unsigned char hostscr[LINES*COLS];
+unsigned char hostcol[LINES*COLS];
+
+void gotoxy(unsigned char x, unsigned char y) { x = x; y = y; }
+unsigned char wherex(void) { return 0; }
+unsigned char wherey(void) { return 0; }
+void cputc(char c) { c = c; }
+void cputs(const char *s) { s = s; }
+int cprintf(const char *fmt, ...) { fmt = fmt; return 0; }
+void cclear(unsigned char n) { n = n; }
+unsigned char revers(unsigned char onoff) { onoff = onoff; return 0; }
+unsigned char kbhit(void) { return 0; }
+char cgetc(void) { return ABORT; }
+
+#define SPOTS 64
+
+static unsigned int spot[SPOTS];    // positions spread over the text
+static unsigned int next[SPOTS];    // start of the line behind each
+static unsigned char text[] = "typed into ned\n";
+
+int main(int argc, char **argv)
+{
+	unsigned int i, l, n;
+	char *op;
+
+	if(argc != 4) {
+		puts("usage: cycles corpus op n");
+		return 1;
+	}
+	op = argv[2];
+	n = atoi(argv[3]);
+
+	// set up as main() does
+	setbufsize(0);
+	setlinesize(0);
+	showtabs = 1;
+	initscreen();
+	setfold();
+	refstate = REFSCR|REFSTA;
+	findpos(0);
+	filename = argv[1];
+
+	if(!strcmp(op, "insertfile")) {
+		for(i = 0; i < n; ++i) {
+			Cursor = 0;
+			insertfile(argv[1]);
+		}
+		return 0;
+	}
+	// insertfile() returns 0 when it could read the file
+	if(insertfile(argv[1]) || !bufsize) {
+		puts("cannot load corpus");
+		return 1;
+	}
+	for(i = 0; i < SPOTS; ++i) {
+		spot[i] = (unsigned int)(((unsigned long)bufsize * i) / SPOTS);
+		l = lineof(spot[i]);
+		next[i] = (l < LINECOUNT) ? linestart(l + 1) : bufsize;
+	}
+	Cursor = 0;
+	findpos(Cursor);
+
+	if(!strcmp(op, "findbol")) {
+		for(i = 0; i < n; ++i) findbol(spot[i & (SPOTS-1)]);
+	} else if(!strcmp(op, "findeol")) {
+		for(i = 0; i < n; ++i) findeol(spot[i & (SPOTS-1)]);
+	} else if(!strcmp(op, "newcol")) {
+		// the column of a spot carried to the next line
+		for(i = 0; i < n; ++i) {
+			Cursor = spot[i & (SPOTS-1)];
+			ccol = 0;
+			newcol(next[i & (SPOTS-1)]);
+		}
+	} else if(!strcmp(op, "findpos")) {
+		// the cursor going down line by line
+		for(i = l = 0; i < n; ++i) {
+			if(++l > LINECOUNT) l = 0;
+			findpos(linestart(l));
+		}
+	} else if(!strcmp(op, "refrscr")) {
+		// a whole screen from the middle of the text
+		Cursor = spot[SPOTS/2];
+		for(i = 0; i < n; ++i) {
+			refstate = REFSCR;
+			refrscr();
+		}
+	} else if(!strcmp(op, "insert")) {
+		for(i = 0; i < n; ++i) {
+			Cursor = spot[i & (SPOTS-1)];
+			insert(text, sizeof(text) - 1);
+		}
+	} else if(!strcmp(op, "cur_delete")) {
+		// from the first half, the text gets shorter
+		for(i = 0; i < n; ++i) {
+			Cursor = spot[i & (SPOTS-1)] >> 1;
+			cur_delete(sizeof(text) - 1);
+		}
+	} else if(!strcmp(op, "find")) {
+		// through the whole text, the pattern is not in it
+		for(i = 0; i < n; ++i) {
+			Cursor = 0;
+			find("zebra");
+		}
+	} else {
+		puts("unknown op");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,122 @@
+/*
+  writes the files the bench target edits into the directory given:
+	long.txt	lines of a few thousand chars, panned across
+	tabs.txt	source with lots of tabs to expand
+	ctrl.txt	control chars, shown as two glyphs each
+	big.txt		60k of short lines
+	c64.txt		8k of all of the above, for the sim65 harness
+  the same files every time, so runs can be compared.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned long seed = 1;
+
+static unsigned rnd(unsigned n)
+{
+	seed = seed * 1103515245UL + 12345UL;
+	return (unsigned)((seed >> 8) % n);
+}
+
+static const char *words[] = {
+	"the", "editor", "keeps", "text", "in", "a", "gap", "buffer", "and",
+	"draws", "only", "what", "changed", "on", "screen", "line", "find",
+	"cut", "paste", "hello", "world", "c64", "ned", "of", "to", "with"
+};
+#define NWORDS (sizeof(words) / sizeof(words[0]))
+
+// words up to about n chars
+static void prose(FILE *f, unsigned n)
+{
+	unsigned c;
+
+	for(c = 0; c < n; ) {
+		if(c) {
+			fputc(' ', f);
+			++c;
+		}
+		c += fprintf(f, "%s", words[rnd(NWORDS)]);
+	}
+}
+
+static FILE *create(const char *dir, const char *name)
+{
+	static char path[256];
+	FILE *f;
+
+	sprintf(path, "%s/%s", dir, name);
+	if(!(f = fopen(path, "wb"))) {
+		perror(path);
+		exit(1);
+	}
+	return f;
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = (argc > 1) ? argv[1] : ".";
+	FILE *f;
+	unsigned i, j;
+	long n;
+
+	f = create(dir, "long.txt");
+	for(i = 0; i < 24; ++i) {
+		prose(f, 500 + rnd(2500));
+		fputc('\n', f);
+	}
+	fclose(f);
+
+	f = create(dir, "tabs.txt");
+	for(i = 0; i < 800; ++i) {
+		for(j = rnd(5); j; --j) fputc('\t', f);
+		prose(f, rnd(30));
+		if(rnd(2)) {
+			fputs("\t\t// ", f);
+			prose(f, rnd(20));
+		}
+		fputc('\n', f);
+	}
+	fclose(f);
+
+	f = create(dir, "ctrl.txt");
+	for(i = 0; i < 600; ++i) {
+		for(j = 5 + rnd(30); j; --j) {
+			switch(rnd(4)) {
+			case 0:
+				// anything but newline and tab
+				fputc(1 + rnd(8), f);
+				break;
+			case 1:
+				fputc(128 + rnd(32), f);
+				break;
+			default:
+				fputs(words[rnd(NWORDS)], f);
+			}
+		}
+		fputc('\n', f);
+	}
+	fclose(f);
+
+	f = create(dir, "big.txt");
+	for(n = 0; n < 60L*1024; ) {
+		j = rnd(70);
+		prose(f, j);
+		fputc('\n', f);
+		n = ftell(f);
+	}
+	fclose(f);
+
+	// small enough to leave room for editing in the 6502's 64k
+	f = create(dir, "c64.txt");
+	for(n = 0; n < 8L*1024; ) {
+		for(j = rnd(3); j; --j) fputc('\t', f);
+		prose(f, rnd(70));
+		if(!rnd(8)) fputc(1 + rnd(8), f);
+		fputc('\n', f);
+		n = ftell(f);
+	}
+	fclose(f);
+	return 0;
+}
@@ -11,6 +11,7 @@
  * fulfill that role.
  *
  * Usage: ned filename [line]
+ *	ned -e script filename	(edit without the screen, see batch())
  *
  * Simple commands:
  *	PF1, Ctrl/V		             Function shift key (SHIFT below)
@@ -21,13 +22,14 @@
  *	NextScreen, Ctrl/N	       * Down a screen
  *	Ctrl/D			           * Delete character to right
  *	DEL, Ctrl/H		           Delete character to left
- *	Ctrl/K			Delete to end of line
+ *	Ctrl/K			Cut to end of line, repeated adds to the cut
  *	Select, Ctrl/B		Mark start of selection
  *	Remove, Ctrl/W		Cut from mark to cursor
  *	InsertHere, Ctrl/Y	Paste cut text
  *	Ctrl/J			Justify line
  *	Find, Ctrl/F		Find text
  *	Ctrl/G			Go to specific line number
+ *	Ctrl/Z			Undo
  *	Ctrl/^			Insert control character
  *	Ctrl/L			Refresh screen
  *	Ctrl/C			Quit without saving
@@ -37,9 +39,14 @@
  *	PrevScreen, Ctrl/U	Go to top of file
  *	NextScreen, Ctrl/N	Go to bottom of file
  *	Find, Ctrl/F		Find text backwards
+ *	Ctrl/Z			Redo
  *	i, I			Include file
  *	w, W			Save file under new name
  *	r, R			Replace found text with contents of cut buffer
+ *	a			Replace all found text with contents of cut buffer
+ *	s			Incremental find, DEL goes back, Ctrl/C aborts
+ *	c			Toggle case sensitive find
+ *	p, d, z			Profile: show top, dump to file, clear (-DPROFILE)
  *
  * Above keys are DEC LK201/401 names; PC-101/104 equivalents are:
  *	PrevScreen	PageUp
@@ -66,6 +73,38 @@
  *
  * Note: Under DOS requires ANSI.SYS or equivalent.
  *
+ * Compiling for the C64 with cc65 (-DREU keeps text that does not fit
+ * in memory in a RAM expansion unit, up to 128k, -DHIRAM in the 11k of
+ * RAM under I/O and KERNAL, -DPACK packed in the main memory the window
+ * leaves free, which holds it at about 1.7 to 1):
+ *	cl65 -Osir -t c64 main.c -o main.prg
+ *	cl65 -Osir -t c64 -DREU main.c -o main-reu.prg
+ *	cl65 -Osir -t c64 -C ned.cfg -DHIRAM main.c -o main-hiram.prg
+ *	cl65 -Osir -t c64 -DPACK main.c -o main-pack.prg
+ *
+ * Compiling natively for measuring, with the headless conio in host/
+ * that reads the keys from a script (make bench runs the scripts in
+ * host/ on generated files and reports time and work per command):
+ *	cc -O2 -funsigned-char -DBENCH -Ihost main.c host/conio.c -o ned-host
+ *	./ned-host file < host/move.keys
+ *
+ * -DMMAP makes the native build map the file instead of reading it, and
+ * keep the text away from the cursor as a table of pieces of the file
+ * and of what was edited. opening a file only counts its lines:
+ *	cc -O2 -funsigned-char -DBENCH -DMMAP -Ihost main.c host/conio.c -o ned-map
+ *
+ * make check runs the key and batch scripts it names through ned-host,
+ * ned-map and ned-pack, the same with -DPACK, and fails if the files
+ * they leave or what they print differ. with -fsanitize=address in
+ * HOSTCFLAGS it also catches reads and writes out of bounds.
+ *
+ * make cycles builds host/cycles.c for sim65 and reports the 6502 cycles
+ * per call of the hot paths, on the same text every time.
+ *
+ * -DPROFILE makes TRACE() count calls and CIA timer cycles per function
+ * on the C64, shown and written out with the shifted p, d and z keys:
+ *	cl65 -Osir -t c64 -DPROFILE main.c -o main-prof.prg
+ *
  * Author:
  *	Don Stokes
  *	Daedalus Consulting Services
@@ -107,18 +146,52 @@
 #include <string.h>
 #include <ctype.h>
 
+#ifdef REU
+#include <c64.h>
+#include <em.h>
+#define FARSTORE
+#elif defined(HIRAM) || defined(PACK)
+#define FARSTORE
+#elif defined(MMAP)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#define FARSTORE
+#endif
+
 #ifdef __CC65__
 #pragma staticlocals (1)
+#else
+#include <unistd.h>
 #endif
 
+// the mapped file is saved over by renaming it to the backup, which
+// keeps it mapped as it is
+#ifndef MMAP
 #define rename(_a,_b) (0)
 #define chmod(f,m)
 #define chown(f,o,g)
 #define lstat(f,b) (0)
+#endif
 
 #define LINES 25
 #define COLS  40
 
+// the text area and status line are written straight into screen RAM
+#ifdef __C64__
+#define SCRRAM ((unsigned char*)0x0400)
+#define COLRAM ((unsigned char*)0xd800)
+#define TEXTCOLOR (*(unsigned char*)0x0286)
+#define FLASHBG() (++*(unsigned char*)0xd021)
+#else
+// or into the one kept by the conio shim in host/ for the native build,
+// and by the sim65 harness
+#define SCRRAM hostscr
+#define COLRAM hostcol
+#define TEXTCOLOR (1)
+#define FLASHBG()
+#endif
+
 #define CH_CR 13
 #define CH_LF 10
 
@@ -181,22 +254,105 @@
 #define VERSION "ned65 v0.9a"
 
 /* (editor handles ~16k files on c64) */
+#ifdef PACK
+#define FIRSTBUFCHUNK  (FARWINDOW + FILEBLOCK + EXTENDBUFCHUNK)  /* the whole window */
+#else
 #define FIRSTBUFCHUNK  (1024*4)
+#endif
 #define EXTENDBUFCHUNK (512)
 
-#define INSBUFSIZE (512)
+/* files are read and written in blocks of this size */
+#define FILEBLOCK (1024)
+
+#ifdef PACK
+#define FIRSTLINECHUNK  (FIRSTBUFCHUNK/16)  /* lines of 16 chars in the window */
+#else
+#define FIRSTLINECHUNK  (128)
+#endif
+#define EXTENDLINECHUNK (64)
+
+/* undo journal size, the history kept never takes more */
+#ifndef UNDOSIZE
+#define UNDOSIZE (2048)
+#endif
+
+#ifdef FARSTORE
+/* text that does not fit in memory goes to far store in slots of FARBLOCK */
+#ifdef REU
+#define FARBLOCK  (2048)
+#define FARSLOTS  (64)
+#elif defined(HIRAM)
+#define FARBLOCK  (1024)
+#define FARSLOTS  (11)          /* RAM under I/O and KERNAL, $d000-$fbff */
+#elif defined(MMAP)
+#define FARBLOCK  (16*1024)
+#define FARSLOTS  (64*1024)     /* pieces, up to 1G of text */
+#else
+#define FARBLOCK  (1024)
+#define FARSLOTS  (48)          /* as many as fit packed, most text packs to half */
+#ifndef PACKPOOL
+#define PACKPOOL  (12*1024)     /* memory the packed blocks share, natively */
+#endif
+/* heap left to the window, its lines and a cut of as much again */
+#define PACKKEEP  (FIRSTBUFCHUNK + FIRSTLINECHUNK*2 + FARWINDOW)
+#endif
+#ifdef MMAP
+typedef unsigned int    SLOTTYPE;
+#else
+typedef unsigned char   SLOTTYPE;
+#endif
+#ifdef PACK
+#define FARMARGIN (FARBLOCK)    /* the window takes from the pool here */
+#define FARWINDOW (FARBLOCK*4)
+#else
+#define FARMARGIN (FARBLOCK*2)  /* text kept in memory around the cursor */
+#define FARWINDOW (FARBLOCK*6)  /* text kept in memory at most, if possible */
+#endif
+#define TEXTSIZE  (winbase + bufsize + winafter)
+#define TEXTPOS(c) (winbase + (c))
+#define KEYRUN    FARBLOCK      /* keys typed ahead moved over in one go */
+#else
+#define TEXTSIZE  bufsize
+#define TEXTPOS(c) (c)
+#define farfit(p) (p)
+#define KEYRUN    (0xffff)
+#endif
 
 unsigned char *buffer;
 unsigned char *cutbuffer;
 unsigned int Cursor,scrtop,bufsize,cutbufsize,cutpoint,bufalloc;
+unsigned int cutalloc;
+unsigned char cutmore;          // Ctrl/K adds to the cut buffer
+unsigned int gapstart,gaplen;
+unsigned int *lineidx;
+unsigned int linealloc,linefront,lineback;
+#ifdef FARSTORE
+unsigned int farlen[FARSLOTS],farnl[FARSLOTS];
+SLOTTYPE farslots,farfront,farback;
+unsigned long winbase,winafter;
+unsigned int winlines;
+signed char scrlost;            // the top of screen left the window (-1 before, 1 behind)
+#endif
 char *showmessage;
 //char scrnupd = 0;
 char scrbuf[256];
+char batchmode;                 // running a script, nothing is shown
+char *batcherr;                 // the error that stops the script
 
 int row,col,actualcol,leftmargin;
 int ccol;
 
 int refstate;
+int keyroll;                    // rows scrolled by keys typed ahead
+
+unsigned int rowstart[LINES];
+unsigned int topline,geompos;
+int geomrow,geomcol;
+char rowsvalid,geomvalid;
+
+// the chars at the left and right edge of each row, with their columns
+unsigned int panleft[LINES],panlcol[LINES],panright[LINES],panrcol[LINES];
+char panvalid[LINES],panany;
 unsigned int refpos;
 
 int selactive;
@@ -207,12 +363,163 @@ int modified;
 char showtabs;
 char t1='t',t2='.'; // tab characters
 
+/*
+  how each char is displayed: chwidth[] is 1 for printable chars, 2 for
+  control chars shown as ^X or &X, and 0 for tab, which runs up to the
+  next multiple of 8. scrcode[] is the screen code cputc() would print
+  for a printable char, or the ^/& of a control char, scrcode2[] the
+  second glyph of a control char.
+*/
+const unsigned char chwidth[256] = {
+	0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x00,0x02,0x02,0x02,0x02,0x02,0x02,
+	0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,
+	0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,
+	0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,
+	0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,
+	0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,
+	0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,
+	0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x02,
+	0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,
+	0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,
+	0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,
+	0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,
+	0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,
+	0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,
+	0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,
+	0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x02
+};
+const unsigned char scrcode[256] = {
+	0x1e,0x1e,0x1e,0x1e,0x1e,0x1e,0x1e,0x1e,0x1e,0x20,0x1e,0x1e,0x1e,0x1e,0x1e,0x1e,
+	0x1e,0x1e,0x1e,0x1e,0x1e,0x1e,0x1e,0x1e,0x1e,0x1e,0x1e,0x1e,0x1e,0x1e,0x1e,0x1e,
+	0x20,0x21,0x22,0x23,0x24,0x25,0x26,0x27,0x28,0x29,0x2a,0x2b,0x2c,0x2d,0x2e,0x2f,
+	0x30,0x31,0x32,0x33,0x34,0x35,0x36,0x37,0x38,0x39,0x3a,0x3b,0x3c,0x3d,0x3e,0x3f,
+	0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f,
+	0x10,0x11,0x12,0x13,0x14,0x15,0x16,0x17,0x18,0x19,0x1a,0x1b,0x1c,0x1d,0x1e,0x1f,
+	0x40,0x41,0x42,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x4b,0x4c,0x4d,0x4e,0x4f,
+	0x50,0x51,0x52,0x53,0x54,0x55,0x56,0x57,0x58,0x59,0x5a,0x5b,0x5c,0x5d,0x5e,0x1e,
+	0x26,0x26,0x26,0x26,0x26,0x26,0x26,0x26,0x26,0x26,0x26,0x26,0x26,0x26,0x26,0x26,
+	0x26,0x26,0x26,0x26,0x26,0x26,0x26,0x26,0x26,0x26,0x26,0x26,0x26,0x26,0x26,0x26,
+	0x60,0x61,0x62,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x6b,0x6c,0x6d,0x6e,0x6f,
+	0x70,0x71,0x72,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x7b,0x7c,0x7d,0x7e,0x7f,
+	0x40,0x41,0x42,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x4b,0x4c,0x4d,0x4e,0x4f,
+	0x50,0x51,0x52,0x53,0x54,0x55,0x56,0x57,0x58,0x59,0x5a,0x5b,0x5c,0x5d,0x5e,0x5f,
+	0x60,0x61,0x62,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x6b,0x6c,0x6d,0x6e,0x6f,
+	0x70,0x71,0x72,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x7b,0x7c,0x7d,0x7e,0x26
+};
+const unsigned char scrcode2[256] = {
+	0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x20,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f,
+	0x10,0x11,0x12,0x13,0x14,0x15,0x16,0x17,0x18,0x19,0x1a,0x1b,0x1c,0x1d,0x1e,0x1f,
+	0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,
+	0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,
+	0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,
+	0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,
+	0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,
+	0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x3f,
+	0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f,
+	0x10,0x11,0x12,0x13,0x14,0x15,0x16,0x17,0x18,0x19,0x1a,0x1b,0x1c,0x1d,0x1e,0x1f,
+	0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,
+	0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,
+	0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,
+	0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,
+	0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,
+	0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x3f
+};
+
+#ifdef BENCH
+// native build: count the calls, host/conio.c sums them up per command
+#define TRACE(m) { static int t; if(!t) t = benchname(m); ++benchwork[t]; }
+#define IDLE()
+#elif defined(PROFILE)
+#define TRACE(m) { static unsigned char t; if(!t) t = profname(m); profenter(t); }
+#define IDLE() profenter(0)
+#else
 #define TRACE(m)
+#define IDLE()
+#endif
+
+#ifdef PROFILE
+/*
+  profiling build: TRACE() counts the calls of each function and reads
+  the CIA 2 timers, cascaded into a 32 bit counter of cycles. the cycles
+  up to the next TRACE() go to the function entered last, so what a
+  function does after returning from a traced call is booked on the
+  callee. slot 0 is the time spent waiting for keys (IDLE()), it is not
+  shown. the timer is stopped while the table is updated, so the
+  profiler does not count itself.
+*/
+#define PROFSLOTS 80
+
+#define TIMERA   (*(unsigned int*)0xdd04)
+#define TIMERB   (*(unsigned int*)0xdd06)
+#define TIMERCRA (*(unsigned char*)0xdd0e)
+#define TIMERCRB (*(unsigned char*)0xdd0f)
+
+const char *profnames[PROFSLOTS];
+unsigned long profcalls[PROFSLOTS];
+unsigned long profcycles[PROFSLOTS];
+unsigned char profcount = 1;
+unsigned char profcur;
+unsigned long proflast;
+
+unsigned char __fastcall__ profname(const char *name)
+{
+	unsigned char i;
+
+	if(profcount == 1) {
+		// timer A counts cycles, timer B its underflows
+		TIMERCRA = 0;
+		TIMERCRB = 0;
+		TIMERA = 0xffff;
+		TIMERB = 0xffff;
+		TIMERCRB = 0x51;
+		TIMERCRA = 0x11;
+		proflast = 0xffffffffUL;
+	}
+	// the same name can be traced in more than one place
+	for(i = 1; i < profcount; ++i) if(!strcmp(profnames[i], name)) return i;
+	if(profcount >= PROFSLOTS) return 0;
+	profnames[profcount] = name;
+	return profcount++;
+}
+
+void __fastcall__ profenter(unsigned char t)
+{
+	unsigned long now;
+
+	TIMERCRA = 0;
+	// the timers count down
+	now = ((unsigned long)TIMERB << 16) | TIMERA;
+	profcycles[profcur] += proflast - now;
+	++profcalls[t];
+	profcur = t;
+	proflast = now;
+	TIMERCRA = 0x01;
+}
+#endif
+
+/*
+  the text is kept in a gap buffer: buffer[0..gapstart) holds the text before
+  the gap, buffer[gapstart+gaplen..bufalloc) the text after it. the gap is
+  moved to the cursor before editing, so typing and deleting never have to
+  shift more than the distance the cursor moved since the last edit.
+*/
+#define BUFPOS(c) (((c) < gapstart) ? (c) : (c) + gaplen)
+#define BUFAT(c)  buffer[BUFPOS(c)]
+
+/*
+  the line index mirrors the gap: lineidx[0..linefront) holds the start
+  offsets of the lines whose newline is in front of the gap, the top
+  lineback entries of lineidx hold the lines behind it as distance from
+  the end of text. inserting or deleting at the gap leaves both halves
+  valid, moving the gap only carries the entries it passes over.
+*/
+#define LINECOUNT (linefront + lineback)
 
 #define REFEOL 1
 #define REFEOS 2
 #define REFSCR 4
 #define REFSTA 8
+#define REFROLL 16
 
 #define UPARR     CH_CURS_UP
 #define DOWN      CH_CURS_DOWN
@@ -249,83 +556,289 @@ char t1='t',t2='.'; // tab characters
 #define QUOTE 	  CH_CTRL_AT	    /* Ctrl/@ */
 #define SHIFT     CH_CTRL_V     	/* Ctrl/V */
 #define GOTO 	  CH_CTRL_G	    	/* Ctrl/G */
+#define UNDO      CH_CTRL_Z         /* Ctrl/Z */
 
 typedef unsigned char   BOOLTYPE;
 typedef unsigned char   KEYTYPE;
 typedef unsigned char   CHARTYPE;
+// sizeof(KEYTYPE) and sizeof(CHARTYPE), for the preprocessor
+#define KEYSIZE  1
+#define CHARSIZE 1
+#ifdef FARSTORE
+typedef unsigned long   POSTYPE;    /* position in the whole text */
+#else
+typedef unsigned int    POSTYPE;
+#endif
 
 /*
   some util-routines
 */
 
-// scan back to beginning of previous line
+// start offset of line n (counted from 0, n <= LINECOUNT)
+unsigned int __fastcall__ linestart(unsigned int n)
+{
+	if(!n) return 0;
+	if(n <= linefront) return lineidx[n-1];
+	return bufsize - lineidx[linealloc - lineback + (n - 1 - linefront)];
+}
+
+// number of the line containing position c (counted from 0)
+unsigned int __fastcall__ lineof(unsigned int c)
+{
+	unsigned int lo, hi, mid;
+
+	TRACE("lineof")
+	lo = 0; hi = LINECOUNT;
+	while(lo < hi) {
+		mid = (lo + hi + 1) >> 1;
+		if(linestart(mid) <= c) lo = mid;
+		else hi = mid - 1;
+	}
+	return lo;
+}
+
+// find beginning of the line containing c
 // in: current position  out: new position
 //unsigned int __fastcall__ findbol(unsigned int c) {
 unsigned int findbol(unsigned int c) {
-unsigned char *buf= buffer;
     TRACE("findbol")
 
-	while (c)
-    {
-		--c;
-		if (buf[c] == '\n')
-        {
-			++c;
-			break;
+	return linestart(lineof(c));
+}
+
+unsigned int __fastcall__ findeol(unsigned int c) {
+	unsigned int n;
+
+	TRACE("findeol")
+	n = lineof(c);
+	if(n < LINECOUNT) return linestart(n+1) - 1;
+	return bufsize;
+}
+
+/*
+  column checkpoints for the line worked on last, starting at colbol:
+  colmark[k] is the column of the char at colbol + k*COLSTEP, known for k
+  below colmarks. they are taken as the line is scanned and dropped from
+  an edit onward, so on a long line a column costs a scan of at most
+  COLSTEP chars instead of one from the start of the line.
+*/
+#define COLSTEP  128
+#define COLMARKS 64
+
+unsigned int colbol,colmark[COLMARKS];
+unsigned int colmarks;
+
+// the column of pos, on the line starting at bol
+unsigned int __fastcall__ colof(unsigned int bol, unsigned int pos)
+{
+	unsigned int c,i,k;
+	unsigned char n,w;
+
+	TRACE("colof")
+	if((bol != colbol) || !colmarks) {
+		colbol = bol;
+		colmarks = 1;
+	}
+	// from the last checkpoint in front of pos
+	if((k = (pos - bol) / COLSTEP) >= colmarks) k = colmarks - 1;
+	c = bol + k * COLSTEP;
+	i = colmark[k];
+	for(;;) {
+		for(n = COLSTEP; n && (c < pos); --n, ++c) {
+			if((w = chwidth[BUFAT(c)])) i += w;
+			else i = (i + 8) & ~7;
 		}
+		if(c == pos) return i;
+		if((++k < COLMARKS) && (k == colmarks)) colmark[colmarks++] = i;
+	}
+}
+
+// the position of column col on the line starting at bol, of the char
+// that covers it or the end of the line
+unsigned int __fastcall__ colpos(unsigned int bol, unsigned int col)
+{
+	CHARTYPE ch;
+	unsigned int c,i,k;
+	unsigned char n,w;
 
+	TRACE("colpos")
+	if((bol != colbol) || !colmarks) {
+		colbol = bol;
+		colmarks = 1;
 	}
+	// from the last checkpoint left of col
+	for(k = colmarks - 1; colmark[k] > col; --k) ;
+	c = bol + k * COLSTEP;
+	i = colmark[k];
+	for(;;) {
+		for(n = COLSTEP; n && (i < col); --n, ++c) {
+			if((c == bufsize) || ((ch=BUFAT(c)) == '\n')) return c;
+			if((w = chwidth[ch])) i += w;
+			else i = (i + 8) & ~7;
+		}
+		if(i >= col) break;
+		if((++k < COLMARKS) && (k == colmarks)) colmark[colmarks++] = i;
+	}
+	if(i != col) c--;
 	return c;
 }
 
-unsigned int __fastcall__ findeol(unsigned int c) {
-unsigned char *buf = buffer;
-	TRACE("findeol")
-  	for(; (buf[c] != '\n') && (c < bufsize); ++c);
-//  while((buf[c] != '\n') && (c < bufsize)) c++;
-	return (c);
+// n chars are inserted (n > 0) or deleted at pos, the checkpoints up to
+// pos stay
+void __fastcall__ coledit(unsigned int pos, int n)
+{
+	unsigned int k;
+
+	if(pos < colbol) {
+		if((n > 0) || ((pos - n) < colbol)) colbol += n;
+		else colmarks = 0;
+	} else if((k = (pos - colbol) / COLSTEP) < colmarks) colmarks = k + 1;
 }
 
 unsigned int __fastcall__ newcol(unsigned int c)
 {
-unsigned char *buf = buffer;
-CHARTYPE ch;
-//	unsigned int d;
-	unsigned int i;
-
 	TRACE("newcol")
 
 //	*(char*)0xd020+=1;
 
-	if(!ccol) {
-		i = findbol(Cursor);
-		// find out cursor column
-		for(ccol = 0; i < Cursor; ++i)
-        {
-//			if(buf[d] == TABCODE) while(++ccol % 8);
-//			else if(buf[d] < ' ' || buf[d] == 127) ccol += 2;
-//			else ccol++;
-			if((ch=buf[i]) == TABCODE) while(++ccol & 7);
-			else if(!isprint(ch)) ccol+=2;
-			else ccol++;
+	// find out cursor column
+	if(!ccol) ccol = colof(findbol(Cursor), Cursor);
+	// scan to cursor column
+	return colpos(c, ccol);
+}
+
+/*
+  screen geometry cache: rowstart[] holds the offset of each visible row
+  (rowstart[LINES-1] is the row below the screen), geompos/geomrow/geomcol
+  the last position findpos() worked out. the edit primitives keep both up
+  to date, so findpos() only has to walk the distance the cursor moved.
+*/
+
+// the edges of the rows are to be found again
+void __fastcall__ panclear(void)
+{
+	if(panany) {
+		memset(panvalid, 0, sizeof(panvalid));
+		panany = 0;
+	}
+}
+
+// recompute the visible rows from scrtop
+void __fastcall__ setrows(void)
+{
+	unsigned char r;
+	unsigned int l;
+
+	TRACE("setrows")
+	topline = lineof(scrtop);
+	rowstart[0] = scrtop;
+	for(r = 1, l = topline+1; r < LINES; ++r, ++l)
+		rowstart[r] = (l <= LINECOUNT) ? linestart(l) : bufsize+1;
+	rowsvalid = 1;
+	panclear();
+}
+
+// n chars are inserted (n > 0) or deleted at pos: the edges of rows
+// behind it move along, those on the row of pos have to be found again
+void __fastcall__ panedit(unsigned int pos, int n)
+{
+	unsigned char r;
+
+	for(r = 0; r < (LINES-1); ++r) {
+		if(!panvalid[r] || (panright[r] < pos)) continue;
+		if(rowstart[r] > pos) {
+			panleft[r] += n;
+			panright[r] += n;
+		} else panvalid[r] = 0;
+	}
+}
+
+#ifdef MMAP
+/* where text in the window came from, for the piece table further down */
+#define MAPANCHORS (16)
+
+static unsigned long anchorpos[MAPANCHORS],anchororg[MAPANCHORS];
+static unsigned char anchornext;
+
+// n chars were inserted at pos, or -n deleted there
+void __fastcall__ mapedit(unsigned long pos, long n)
+{
+	unsigned char i;
+
+	for(i = 0; i < MAPANCHORS; ++i) {
+		if(anchorpos[i] < pos) continue;
+		if((n >= 0) || (anchorpos[i] >= (pos - n))) anchorpos[i] += n;
+		else {
+			// its text is gone, the anchor goes on behind it
+			anchororg[i] += (pos - n) - anchorpos[i];
+			anchorpos[i] = pos;
 		}
 	}
-	// scan to cursor column
-	for(i = 0; i < ccol; ++c)
-    {
-//		if((buf[c] == '\n') || (c == bufsize)) return c;
-//		if(buf[c] == TABCODE) while(++i % 8);
-//		else if(buf[c] < ' ' || buf[c] == 255 ||
-//			(buf[c] >= 127 && buf[c] < 160)) i += 2;
-//		else		     i++;
-
-		if(((ch=buf[c]) == '\n') || (c == bufsize)) return c;
-		if(ch == TABCODE) while(++i & 7);
-		else if(!isprint(ch)) i+=2;
-		else i++;
-	}
-	if(i != ccol) c--;
-	return c;
+}
+
+#endif
+
+// n chars with nl newlines were inserted at pos
+void __fastcall__ geominsert(unsigned int pos, unsigned int n, unsigned int nl)
+{
+	unsigned char r;
+
+	coledit(pos, n);
+#ifdef MMAP
+	mapedit(TEXTPOS(pos), n);
+#endif
+	// an edit above the screen moves the top line along with the text
+	if(pos < scrtop) {
+		scrtop += n;
+		rowsvalid = 0;
+	} else if(nl) rowsvalid = 0;
+	else if(rowsvalid) {
+		for(r = 1; r < LINES; ++r) if(rowstart[r] > pos) rowstart[r] += n;
+		if(panany) panedit(pos, n);
+	}
+	if(pos < geompos) geomvalid = 0;
+}
+
+// n chars with nl newlines are about to be deleted at pos
+void __fastcall__ geomdelete(unsigned int pos, unsigned int n, unsigned int nl)
+{
+	unsigned char r;
+	unsigned int c;
+	int w;
+	CHARTYPE ch;
+
+	coledit(pos, -(int)n);
+#ifdef MMAP
+	mapedit(TEXTPOS(pos), -(long)n);
+#endif
+	if(pos < scrtop) {
+		if((pos + n) < scrtop) scrtop -= n;
+		else {
+			// the top line is joined to the one above it
+			scrtop = findbol(pos);
+			refstate |= REFSCR;
+		}
+		rowsvalid = 0;
+	} else if(nl) rowsvalid = 0;
+	else if(rowsvalid) {
+		for(r = 1; r < LINES; ++r) if(rowstart[r] > pos) rowstart[r] -= n;
+		if(panany) panedit(pos, -(int)n);
+	}
+	if(!geomvalid || (geompos <= pos)) return;
+	// deleting in front of the last position found only shifts it left,
+	// as long as it is on the same row and there is no tab to realign
+	if(!nl && (geompos >= (pos + n))) {
+		for(c = pos, w = 0; c < geompos; ++c) {
+			if(((ch=BUFAT(c)) == TABCODE) || (ch == '\n')) break;
+			if(c < (pos + n)) w += chwidth[ch];
+		}
+		if(c == geompos) {
+			geompos -= n;
+			geomcol -= w;
+			return;
+		}
+	}
+	geomvalid = 0;
 }
 
 /*
@@ -345,69 +858,72 @@ CHARTYPE ch;
 
 int __fastcall__ findpos(unsigned int pos)
 {
-unsigned char *buf = buffer;
 CHARTYPE ch;
-unsigned int c;
-unsigned int r,rr /*,i*/;
+unsigned int c,l;
+int r,rr,i;
 
 	TRACE("findpos")
-	r = 0;
+	if(!rowsvalid) setrows();
+	rr = 0;
 	if(scrtop > pos) {
-		rr = 0;
-		for(c = pos; c < scrtop; ++c) if(buf[c] == '\n') --rr;
-		scrtop = findbol(pos);
-		row = 0; col = 0;
-		for(c = scrtop; c < pos; ++c) {
-			++col;
-//			if(buf[c] == TABCODE) for(; (col % 8) != 0; col++);
-//			else if(buf[c] < 32 || buf[c] == 255 ||
-//				(buf[c] > 126 && buf[c] < 160)) col++;
-			// count additional char for control-char
-
-			if((ch=buf[c]) == TABCODE) for(; (col & 7) != 0; ++col);
-			else if(!isprint(ch)) ++col;
-		}
+		// pos goes to the top row
+		l = lineof(pos);
+		// scrtop may be past the end of text after a big cut
+		if(!(rr = l - topline)) rr = -1;
+		scrtop = linestart(l);
+		setrows();
+		geomvalid = 0;
+		r = 0;
 	} else {
-		col = 0;
-		rr = 0;
-		for(c = scrtop; (c < bufsize) && (c != pos); ++c) {
-			++col;
-//			if(buf[c] == '\n') {
-//				r++;
-//				col = 0;
-//			} else if(buf[c] == TABCODE) {
-//				for(; (col % 8) != 0; col++);
-//			} else if(buf[c] < ' ' || buf[c] == 255 ||
-//				  (buf[c] > 126 && buf[c] < 160)) col++;
-
-
-			if((ch=buf[c]) == '\n') {
-				++r;
-				col = 0;
-			} else if(ch == TABCODE) {
-				for(; (col & 7) != 0; ++col);
-			// count additional char for control-char
-			} else if(!isprint(ch)) ++col;
-		}
-		row = r;
+		// look for the row from the last one found
+		r = geomvalid ? geomrow : 0;
+		while(r && (rowstart[r] > pos)) --r;
+		while((r < (LINES-1)) && (rowstart[r+1] <= pos)) ++r;
 		if(r >= (LINES-1)) {
-			c = scrtop;
-			scrtop = findbol(pos);
-			for(; (c < bufsize) && (c != pos); ++c) {
-				if(buf[c] == '\n') {
-					--r;
-					if(r < (LINES-1)) {
-						rr = r;
-						scrtop = (c + 1);
-						break;
-					}
-				}
+			// pos goes to the bottom row
+			l = lineof(pos) - (LINES-2);
+			rr = l - topline;
+			scrtop = linestart(l);
+			setrows();
+			geomvalid = 0;
+			r = LINES-2;
+		}
+	}
+
+	// count columns from the start of the row, or from the last
+	// position found if it is on the same row and close
+	c = rowstart[r];
+	actualcol = 0;
+	if(geomvalid && (geomrow == r)) {
+		if(geompos <= pos) {
+			c = geompos;
+			actualcol = geomcol;
+		} else if((geompos - pos) <= COLSTEP) {
+			// step back unless there is a tab in the way
+			for(c = pos, i = geomcol; c < geompos; ++c) {
+				if((ch=BUFAT(c)) == TABCODE) break;
+				i -= chwidth[ch];
 			}
-			rr = r;
+			if(c == geompos) {
+				c = pos;
+				actualcol = i;
+			} else c = rowstart[r];
 		}
 	}
-	actualcol = col;
-	col -= leftmargin;
+	// far into a long line the column checkpoints are closer
+	if((pos - c) > COLSTEP) actualcol = colof(rowstart[r], pos);
+	else for(; c < pos; ++c) {
+		if((i = chwidth[BUFAT(c)])) actualcol += i;
+		else actualcol = (actualcol + 8) & ~7;
+	}
+
+	geompos = pos;
+	geomrow = r;
+	geomcol = actualcol;
+	geomvalid = 1;
+
+	row = r;
+	col = actualcol - leftmargin;
 	if(col < 0) col = 0;
 	if(col >= COLS) col = (COLS-1);
 	return rr;
@@ -415,7 +931,6 @@ unsigned int r,rr /*,i*/;
 
 void __fastcall__ setref(int state)
 {
-unsigned char *buf = buffer;
 	unsigned int c;
 
 	TRACE("setref")
@@ -436,19 +951,21 @@ unsigned char *buf = buffer;
 		if(refstate & REFEOL) {
 			if(Cursor < refpos) {
 				for(c = Cursor; c < refpos; ++c) {
-					if(buf[c] == '\n') {
-						state |= REFEOS;
+					if(BUFAT(c) == '\n') {
+						refstate |= REFEOS;
 						refpos = Cursor;
 						return;
 					}
 				}
 			} else if(Cursor > refpos) {
+				// keep the first change on the line for the redraw
 				for(c = refpos; c < Cursor; ++c) {
-					if(buf[c] == '\n') {
+					if(BUFAT(c) == '\n') {
 						refstate |= REFEOS;
 						return;
 					}
 				}
+				return;
 			}
 		}
 		refpos = Cursor;
@@ -457,7 +974,11 @@ unsigned char *buf = buffer;
 }
 
 void __fastcall__ message(char *msg, int sts) {   /* sts ?! */
-	sts=sts; // get rid of warning
+	// in batch mode only errors count, they stop the script
+	if(batchmode) {
+		if(sts) batcherr = msg;
+		return;
+	}
 	showmessage = msg;
 	setref(REFSTA);
 }
@@ -466,6 +987,7 @@ void __fastcall__ showbusy(unsigned char flg)
 {
 static char busy[4]={'.','o','O','o'};
 static char cnt=0;
+	if(batchmode) return;
 	++cnt;cnt&=3;
 	gotoxy(COLS-1,LINES-1);
 	if(flg) revers(1);
@@ -474,22 +996,41 @@ static char cnt=0;
 }
 
 unsigned char __fastcall__ cgetcatxy(int x,int y) {
-unsigned char *scrn=(char*)(0x0400+x+(y*40));
+unsigned char *scrn=SCRRAM+x+(y*COLS);
 	return(*scrn);
 }
 void __fastcall__ cputctoxy(unsigned char c,int x,int y) {
-unsigned char *scrn=(char*)(0x0400+x+(y*40));
+unsigned char *scrn=SCRRAM+x+(y*COLS);
 	*scrn=c;
 }
 
+// set up color RAM for the direct writes
+void __fastcall__ initscreen(void)
+{
+	TRACE("initscreen")
+	// conio sets the color of every char it prints, screen RAM writes
+	// use whatever is in color RAM, so fill it with the text color once
+	memset(COLRAM, TEXTCOLOR, LINES*COLS);
+}
+
+// write up to n chars of s to screen RAM at p, rev is 0x80 for reverse
+unsigned char* __fastcall__ scrputs(unsigned char *p, char *s, unsigned char n, unsigned char rev)
+{
+	for(; n && *s; --n) *p++ = scrcode[(unsigned char)*s++] | rev;
+	return p;
+}
+
 //#define cputctoxy(_c,_x,_y) cputcxy(_c,_x,_y)
 
 static char oldrow=-1,oldcol=-1;
 static char oldchar;
 
+// char is unsigned with cc65, so no cursor shown is a row of 255 there
+#define NOCURSOR(r) ((unsigned char)(r) >= LINES)
+
 void __fastcall__ disp_cursor_forceoff(void) {
 		// output original char at old cursor position
-		if((cgetcatxy(oldcol,oldrow)^0x80)==oldchar) {
+		if(!NOCURSOR(oldrow) && ((cgetcatxy(oldcol,oldrow)^0x80)==oldchar)) {
 			cputctoxy(oldchar,oldcol,oldrow);
 		}
 		oldrow=-1;oldcol=-1;
@@ -498,7 +1039,7 @@ void __fastcall__ disp_cursor_forceoff(void) {
 void __fastcall__ disp_cursor(void) {
 unsigned char row=wherey(),col=wherex();
 	if((oldrow!=row)||(oldcol!=col)) { // if new position
-		if((oldrow!=-1)&&(oldcol!=-1)) {
+		if(!NOCURSOR(oldrow)) {
 			// output original char at old cursor position
 //			gotoxy(oldcol,oldrow);revers(1);cputc(oldchar);revers(0);
 			if((cgetcatxy(oldcol,oldrow)^0x80)==oldchar) {
@@ -515,21 +1056,129 @@ unsigned char row=wherey(),col=wherex();
 	cputctoxy(oldchar^0x80,col,row);
 }
 
+/*
+  horizontal panning: when the left margin moves by less than a screen,
+  the rows are shifted in screen RAM and only the columns coming into
+  view are drawn. for that each row keeps the char at its left and right
+  edge with the column it starts at (panleft/panlcol, panright/panrcol).
+  they are found by scanning from the start of the row the first time,
+  after that by going on from where they were. going back works the same
+  unless there is a tab in the way, whose width depends on the text in
+  front of it.
+*/
+#define NOCOL 0xffff
+
+// draw columns x to x+n-1 of a row to p, starting from the char at c that
+// starts at column *s. returns the char that holds column x+n, or the end
+// of the line, with its column in *s. with n = 0 it only looks for x
+unsigned int __fastcall__ pandraw(unsigned char *p, unsigned int c, unsigned int *s, unsigned int x, unsigned char n)
+{
+	unsigned int i,e;
+	unsigned char ch,w,g,*q;
+
+	TRACE("pandraw")
+	e = x + n;
+	q = p + n;
+	for(i = *s; (i < e) && (c < bufsize) && ((ch = BUFAT(c)) != '\n'); ++c) {
+		if((w = chwidth[ch]) == 1) {
+			if(i >= x) *p++ = scrcode[ch];
+		} else if(w) {
+			// control chars are two glyphs
+			if(i >= x) *p++ = scrcode[ch];
+			if(((i + 1) >= x) && ((i + 1) < e)) *p++ = scrcode2[ch];
+		} else {
+			// tabs are t1 followed by t2 up to the next tab stop
+			w = 8 - (i & 7);
+			for(g = 0; g < w; ++g)
+				if(((i + g) >= x) && ((i + g) < e)) *p++ = scrcode[g ? t2 : t1];
+		}
+		if((i + w) > e) break;
+		i += w;
+	}
+	// the line ends before the right edge
+	if(p < q) memset(p, scrcode[' '], q - p);
+	*s = i;
+	return c;
+}
+
+// the char that holds column x going back from the one at c that starts
+// at column *s, NOCOL if there is a tab in the way
+unsigned int __fastcall__ colback(unsigned int c, unsigned int *s, unsigned int x)
+{
+	unsigned int i;
+	unsigned char ch,w;
+
+	TRACE("colback")
+	for(i = *s; i > x; i -= w) {
+		if(!c || ((ch = BUFAT(c-1)) == '\n') || !(w = chwidth[ch])) return NOCOL;
+		--c;
+	}
+	*s = i;
+	return c;
+}
+
+// shift the rows shown by d columns, the left margin was moved already
+void __fastcall__ panrows(int d)
+{
+	unsigned char r;
+	unsigned char *p;
+	unsigned int c,s,m;
+
+	TRACE("panrows")
+	m = leftmargin - d;
+	for(r = 0, p = SCRRAM; (r < (LINES-1)) && (rowstart[r] <= bufsize); ++r, p += COLS) {
+		if(!panvalid[r]) {
+			// the edges for the old margin, from the start of the row
+			s = 0;
+			panleft[r] = pandraw(p, rowstart[r], &s, m, 0);
+			panlcol[r] = s;
+			panright[r] = pandraw(p, panleft[r], &s, m + COLS, 0);
+			panrcol[r] = s;
+		}
+		if(d > 0) {
+			// the columns on the right come in from the old right edge
+			memmove(p, p + d, COLS - d);
+			s = panrcol[r];
+			panright[r] = pandraw(p + (COLS - d), panright[r], &s, m + COLS, d);
+			panrcol[r] = s;
+			s = panlcol[r];
+			panleft[r] = pandraw(p, panleft[r], &s, leftmargin, 0);
+			panlcol[r] = s;
+		} else {
+			memmove(p - d, p, COLS + d);
+			s = panlcol[r];
+			if((c = colback(panleft[r], &s, leftmargin)) == NOCOL) {
+				s = 0;
+				c = pandraw(p, rowstart[r], &s, leftmargin, 0);
+			}
+			panleft[r] = c;
+			panlcol[r] = s;
+			pandraw(p, c, &s, leftmargin, -d);
+			s = panrcol[r];
+			if((c = colback(panright[r], &s, leftmargin + COLS)) == NOCOL) {
+				s = panlcol[r];
+				c = pandraw(p, panleft[r], &s, leftmargin + COLS, 0);
+			}
+			panright[r] = c;
+			panrcol[r] = s;
+		}
+		panvalid[r] = panany = 1;
+	}
+}
+
 // updates screen
 void __fastcall__ refrscr(void)
 {
-unsigned char *buf = buffer;
 unsigned int rstate;
 	unsigned int c/*,ch*/;
-	char ch;
-unsigned int i,r, co, cos, oc;
-    static char outbuf[32];
+	unsigned char ch,w;
+unsigned int i,r, co, cos, rend;
+int sc,pan;
+unsigned char *p,*e;
 
 	TRACE("refrscr")
 	if((refstate & REFSTA) || showmessage) {
 //		move(LINES-1,0);
-		gotoxy(19,LINES-1);
-		revers(1);
 		if(showmessage) if(!showmessage[0]) showmessage = 0;
 		if(showmessage) {
 			if(showmessage != scrbuf) {
@@ -556,39 +1205,52 @@ unsigned int i,r, co, cos, oc;
 
 		scrbuf[i] = 0;
 
-		cputs(scrbuf);
-		revers(0);
+		scrputs(SCRRAM+((LINES-1)*COLS)+19, scrbuf, COLS-19, 0x80);
 	}
 
-	// added display of current line/column in file
-	gotoxy(0,(LINES-1));
-	revers(1);
-	sprintf(scrbuf, "%5d:%5d:%04x %c ",row,actualcol,bufsize,t1);
-	cputs(scrbuf);
-	revers(0);
-
 	rstate = refstate & (REFSCR|REFEOS|REFEOL);
+	rend = LINES-1;
+
+	// a move of a few lines with nothing else to redraw only
+	// scrolls, anything else redraws the whole screen. keys typed ahead
+	// may have scrolled already, then their edits can be off screen
+	sc = findpos(Cursor) + keyroll;
+	keyroll = 0;
+	if(sc || (refstate & REFROLL)) {
+		if(rstate || (sc <= -(LINES-1)) || (sc >= (LINES-1))) rstate = REFSCR;
+		else if(sc) rstate = REFROLL;
+	}
+	refstate &= ~REFROLL;
 
-	if(findpos(Cursor)) rstate = REFSCR;
+	// added display of current line/column in file, after the keys
+	// typed ahead moved it
+#ifdef FARSTORE
+	sprintf(scrbuf, "%5d:%5d:%05lx%c ",row,actualcol,TEXTSIZE,t1);
+#else
+	sprintf(scrbuf, "%5d:%5d:%04x %c ",row,actualcol,bufsize,t1);
+#endif
+	scrputs(SCRRAM+((LINES-1)*COLS), scrbuf, COLS, 0x80);
 
+	pan = leftmargin;
 	if(leftmargin && (actualcol < COLS) && (ccol < COLS)) {
-		for(c = Cursor; (c < bufsize) && (buf[c] != '\n'); ++c) ;
-		if(((c - Cursor) + actualcol) < COLS) {
-			leftmargin = 0;
+		c = findeol(Cursor);
+		if(((c - Cursor) + actualcol) < COLS) leftmargin = 0;
+	}
+	while(actualcol >= (leftmargin + COLS)) leftmargin += 8;
+	while(actualcol < leftmargin) leftmargin -= 8;
+
+	// a new margin pans the rows shown, unless they are redrawn or
+	// scrolled anyway or none of them would stay in view
+	if((pan = leftmargin - pan)) {
+		if((rstate & (REFSCR|REFROLL)) || (pan >= COLS) || (pan <= -COLS)) {
 			rstate = REFSCR;
+			pan = 0;
+			panclear();
 		}
 	}
-	while(actualcol >= (leftmargin + COLS)) {
-		rstate = REFSCR;
-		leftmargin += 8;
-	}
-	while(actualcol < leftmargin) {
-		rstate = REFSCR;
-		leftmargin -= 8;
-	}
 
 	// return if screen doesnt have to be updated
-	if(!rstate)
+	if(!rstate && !pan)
     {
 /*      col/row etc unchanged until now so this one is not needed!
 		findpos(Cursor);
@@ -601,6 +1263,31 @@ unsigned int i,r, co, cos, oc;
 	col = actualcol - leftmargin;
 
 	if(rstate & REFSCR) refpos = scrtop;
+	else if(pan) {
+		panrows(pan);
+		// the row with the end of text is drawn again for the [eof] mark
+		if(rowstart[LINES-1] > bufsize) {
+			c = linestart(LINECOUNT);
+			if(!rstate || (refpos > c)) refpos = c;
+			rstate = REFEOS;
+		}
+		if(!rstate) {
+			findpos(Cursor);
+			refstate = 0;
+			return;
+		}
+	} else if(rstate == REFROLL) {
+		// move the rows still visible, then draw the ones scrolled in
+		if(sc > 0) {
+			memmove(SCRRAM, SCRRAM+(sc*COLS), ((LINES-1)-sc)*COLS);
+			refpos = rowstart[(LINES-1)-sc];
+		} else {
+			sc = -sc;
+			memmove(SCRRAM+(sc*COLS), SCRRAM, ((LINES-1)-sc)*COLS);
+			refpos = scrtop;
+			rend = sc;
+		}
+	}
 	if(findpos(refpos)) {
 		rstate = REFSCR;
 		refpos = scrtop;
@@ -611,7 +1298,11 @@ unsigned int i,r, co, cos, oc;
 
 		r = row;
 		co = actualcol;
-		gotoxy( col,row);
+		p = SCRRAM+(r*COLS);
+		e = p+COLS;
+		p += col;
+		// nothing to draw on this row if the change is right of it
+		if(co >= (leftmargin+COLS)) p = e;
 
 //		for(c = refpos; (r < (LINES-1)) && (c < bufsize); c++) {
 		for(c = refpos; (c < bufsize); ++c)
@@ -620,100 +1311,58 @@ unsigned int i,r, co, cos, oc;
 //		*(char*)0xd020+=1;
 
 			cos = co;    // current column
-			++co;
-			ch = buf[c]; // current byte in buffer
+			ch = BUFAT(c); // current byte in buffer
+
+			// goto next line in file
+			if(ch == '\n') {
+				memset(p, scrcode[' '], e-p);
+				if(rstate == REFEOL) {
+					findpos(Cursor);
+					refstate = 0;
+					return;
+				}
+				++r;
+				p = e;
+				e += COLS;
+				co = 0;
 
-			if(isprint(ch)) {
-					if((cos >= leftmargin) && (cos < (leftmargin+COLS))) {
-						cputc(ch);
-					}
-			} else { // is controlchar
-				// goto next line in file
-				if(ch == '\n') {
-					if(cos < (COLS+leftmargin)) cclear(COLS-wherex());
-					if(rstate == REFEOL) {
-						findpos(Cursor);
-						refstate = 0;
-						return;
-					}
-					++r;
-					gotoxy(0,r);
-					co = 0;
+				if(r >= rend){
+					break;
+				}
 
-					if((r >= (LINES-1))){
-						break;
+			} else if((w = chwidth[ch]) == 1) {
+				++co;
+				if((cos >= leftmargin) && (cos < (leftmargin+COLS))) {
+					*p++ = scrcode[ch];
+				}
+			} else if(w) {
+				// display control chars as two glyphs
+				co += 2;
+				if(((cos) >= leftmargin) && ((cos) < (leftmargin+COLS)))
+					*p++ = scrcode[ch];
+				cos++;
+				if(((cos) >= leftmargin) && ((cos) < (leftmargin+COLS)))
+					*p++ = scrcode2[ch];
+			} else {
+				// display tabs, t1 followed by t2 up to the next tab stop
+				w = scrcode[t1];
+				do {
+					if((cos >= leftmargin) && (cos < (leftmargin+COLS))) {
+						*p++ = w;
 					}
-
-				} else {
-				// output control character
-
-						// display tabs
-						if (ch == TABCODE) {
-
-							outbuf[0] = t1;
-							oc = 1;
-							i = co & 7;
-							if (i) {
-								for(; i < 8; ++co) {
-									outbuf[oc] = t2;
-									++oc;
-									++i;
-								}
-							}
-
-							// output a number of characters
-							for(i = 0; i < oc; ++i) {
-								if(((cos+i) >= leftmargin) && ((cos+i) < (leftmargin+COLS)))
-                                {
-									cputc(outbuf[i]);
-								}
-							}
-
-						}
-						// display control chars
-    					else {
-
-							if (ch < 32) {
-								outbuf[0] = '^';
-								outbuf[1] = ch + '@';
-							} else if (ch == 127) {
-								outbuf[0] = '^';
-								outbuf[1] = '?';
-							} else if (ch < 160) {
-								outbuf[0] = '&';
-								outbuf[1] = (ch - 128) + '@';
-							} else if (ch == 255) {
-								outbuf[0] = '&';
-								outbuf[1] = '?';
-							}
-
-							co++;
-
-							if(((cos) >= leftmargin) && ((cos) < (leftmargin+COLS)))
-								cputc(outbuf[0]);
-							cos++;
-							if(((cos) >= leftmargin) && ((cos) < (leftmargin+COLS)))
-								cputc(outbuf[1]);
-
-						}
-
-				}  // output ctrlchar
-			} // is ctrlchar
+					w = scrcode[t2];
+				} while(++cos & 7);
+				co = cos;
+			}
 
 		}
 
 		// print EOF mark
-		if((c == bufsize) && (r < (LINES-1))) {
-			revers(1);
-			cputs("[eof]");
-			revers(0);
+		if((c == bufsize) && (r < rend)) {
+			p = scrputs(p, "[eof]", e-p, 0x80);
 		}
 		// clear until end of each line
-		if(r < LINES-1) cclear(COLS-wherex());
-		while(++r < (LINES-1)) {
-			gotoxy(0,r);
-			cclear(COLS-wherex());
-		}
+		if(r < rend) memset(p, scrcode[' '], SCRRAM+(rend*COLS)-p);
 
 	findpos(Cursor);
 	refstate = 0;
@@ -731,45 +1380,918 @@ void __fastcall__ redraw(int k) /* k ?! */
 	gotoxy(col,row);
 }
 
+// move the gap to logical position pos
+void __fastcall__ movegap(unsigned int pos)
+{
+	TRACE("movegap")
+	if(pos < gapstart) {
+		memmove(&buffer[pos+gaplen],&buffer[pos],(gapstart-pos));
+		// lines starting behind pos go to the back half of the index
+		while(linefront && (lineidx[linefront-1] > pos)) {
+			++lineback;
+			lineidx[linealloc - lineback] = bufsize - lineidx[--linefront];
+		}
+	} else if(pos > gapstart) {
+		memmove(&buffer[gapstart],&buffer[gapstart+gaplen],(pos-gapstart));
+		while(lineback && ((bufsize - lineidx[linealloc - lineback]) <= pos)) {
+			lineidx[linefront++] = bufsize - lineidx[linealloc - lineback];
+			--lineback;
+		}
+	}
+	gapstart = pos;
+}
+
+/*
+  the cut buffer is kept in the same block as the text, in the cutalloc
+  chars from buffer[bufalloc] on. it grows down into the gap and gives
+  its spare room back when the text needs it, so cutting and pasting
+  never allocate memory of their own and cannot fragment the heap.
+*/
+
+// move the cut buffer and the text behind the gap up by d chars, the gap
+// grows by d
+void __fastcall__ cutmove(unsigned int d)
+{
+	TRACE("cutmove")
+	memmove(&buffer[bufalloc + d], &buffer[bufalloc], cutbufsize);
+	memmove(&buffer[gapstart + gaplen + d], &buffer[gapstart + gaplen], bufsize - gapstart);
+	gaplen += d;
+	bufalloc += d;
+	cutbuffer = &buffer[bufalloc];
+}
+
+// make room for newsize chars of text, the extra space is added to the gap
 unsigned char* __fastcall__ setbufsize(unsigned int newsize)
 {
 	unsigned char *b;
+	unsigned int d;
 	TRACE("setbufsize")
 	if(!buffer) {
 		buffer = (unsigned char *)malloc(FIRSTBUFCHUNK);
 		bufalloc = FIRSTBUFCHUNK;
+		gapstart = 0;
+		gaplen = FIRSTBUFCHUNK;
+		cutbuffer = &buffer[bufalloc];
+	}
+	// the cut buffer's spare room is used first
+	if((newsize >= bufalloc) && (cutalloc > cutbufsize)) {
+		d = cutalloc - cutbufsize;
+		cutalloc = cutbufsize;
+		cutmove(d);
 	}
 	if(newsize >= bufalloc) {
-		if(!(b = (unsigned char *)realloc(buffer, newsize+EXTENDBUFCHUNK))) {
+		if(!(b = (unsigned char *)realloc(buffer, newsize+EXTENDBUFCHUNK+cutalloc))) {
 			message("Insufficient memory", 1);
 			return 0;
 		}
-		*(char*)0xd021+=1;
+		FLASHBG();
+		// the cut buffer and the text behind the gap go to the end of
+		// the new block
 		buffer = b;
-		bufalloc = newsize+EXTENDBUFCHUNK;
+		cutmove((newsize+EXTENDBUFCHUNK) - bufalloc);
 	}
-	bufsize = newsize;
 	return buffer;
 }
 
-unsigned char* __fastcall__ setcutbufsize(unsigned int newsize) {
-	unsigned char *b;
+// make room in the line index for newsize lines
+unsigned int* __fastcall__ setlinesize(unsigned int newsize)
+{
+	unsigned int *l;
+	unsigned int newalloc;
+	TRACE("setlinesize")
+	if(!lineidx) {
+		lineidx = (unsigned int *)malloc(FIRSTLINECHUNK*sizeof(unsigned int));
+		linealloc = FIRSTLINECHUNK;
+	}
+	if(newsize >= linealloc) {
+		newalloc = newsize+EXTENDLINECHUNK;
+		if(!(l = (unsigned int *)realloc(lineidx, newalloc*sizeof(unsigned int)))) {
+			message("Insufficient memory", 1);
+			return 0;
+		}
+		// the back half stays at the top
+		memmove(&l[newalloc-lineback],&l[linealloc-lineback],lineback*sizeof(unsigned int));
+		lineidx = l;
+		linealloc = newalloc;
+	}
+	return lineidx;
+}
+
+// make room for newsize chars in the cut buffer, what it holds stays at
+// its start
+unsigned char* __fastcall__ setcutbufsize(unsigned int newsize)
+{
+	unsigned int d;
 	TRACE("setcutbufsize")
-	if(cutbuffer) free(cutbuffer);
-	if(!(b = (unsigned char *) malloc(newsize))) {
-		message("Insufficent memory", 1);
-		return 0;
+	if(newsize > cutalloc) {
+		// getting more memory may take back the spare room first
+		if((gaplen <= (newsize - cutalloc)) && !setbufsize(bufsize + newsize - cutbufsize)) return 0;
+		d = newsize - cutalloc;
+		// the text behind the gap and the cut buffer move down into it
+		memmove(&buffer[gapstart + gaplen - d], &buffer[gapstart + gaplen], bufsize - gapstart);
+		memmove(&buffer[bufalloc - d], &buffer[bufalloc], cutbufsize);
+		gaplen -= d;
+		bufalloc -= d;
+		cutalloc += d;
+		cutbuffer = &buffer[bufalloc];
 	}
-	cutbuffer = b;
 	cutbufsize = newsize;
-	gotoxy(0,1);cprintf("%04x %d",cutbuffer,cutbufsize);
 	return cutbuffer;
 }
 
-// prompt for user input
-int __fastcall__ ask(char *prompt, char *buf, int siz) {
-	int r,c,k,first,i;
-
+#ifdef FARSTORE
+/*
+  far store: only a window of the text is kept in buffer. the text in
+  front of it is a stack of blocks in far store growing up from slot 0,
+  the text behind it a stack growing down from the last slot. blocks are
+  cut at line starts where there is one, so the window starts and ends
+  with whole lines. all positions and line numbers in the editor are
+  counted from the start of the window, winbase and winlines say where
+  that is in the whole text, winafter how much text follows the window.
+*/
+
+#ifdef REU
+static struct em_copy farcopy;
+
+// returns the number of slots in the REU, 0 if there is none
+SLOTTYPE __fastcall__ farinit(void)
+{
+	unsigned int n;
+
+	TRACE("farinit")
+	if(em_install(c64_reu_emd) != EM_ERR_OK) return 0;
+	n = em_pagecount() / (FARBLOCK/256);
+	return (n > FARSLOTS) ? FARSLOTS : n;
+}
+
+// copy n bytes from p to offset o of slot s
+BOOLTYPE __fastcall__ farput(SLOTTYPE s, unsigned int o, unsigned char *p, unsigned int n)
+{
+	farcopy.buf = p;
+	farcopy.offs = o;
+	farcopy.page = (s * (FARBLOCK/256)) + (o >> 8);
+	farcopy.count = n;
+	if(n) em_copyto(&farcopy);
+	return 1;
+}
+
+// copy n bytes from offset o of slot s to p
+void __fastcall__ farget(SLOTTYPE s, unsigned int o, unsigned char *p, unsigned int n)
+{
+	farcopy.buf = p;
+	farcopy.offs = o;
+	farcopy.page = (s * (FARBLOCK/256)) + (o >> 8);
+	farcopy.count = n;
+	if(n) em_copyfrom(&farcopy);
+}
+#endif
+
+#ifdef HIRAM
+/*
+  the RAM under I/O and KERNAL is only seen with $01 set to $34, which
+  also hides the KERNAL's IRQ and NMI handlers. copies run with IRQs off,
+  an NMI (RESTORE) goes through the RAM vector at $fffa to a plain RTI.
+  ned.cfg keeps the HIRAM segment there and out of the program file.
+*/
+#pragma bss-name (push,"HIRAM")
+static unsigned char farmem[FARSLOTS][FARBLOCK];
+#pragma bss-name (pop)
+
+static unsigned char nmistub = 0x40;    // RTI
+
+// returns the number of slots under the ROMs
+SLOTTYPE __fastcall__ farinit(void)
+{
+	TRACE("farinit")
+	// writes to $fffa go to the RAM under the KERNAL anyway
+	*(unsigned int*)0xfffa = (unsigned int)&nmistub;
+	return FARSLOTS;
+}
+
+// copy n bytes from p to offset o of slot s
+BOOLTYPE __fastcall__ farput(SLOTTYPE s, unsigned int o, unsigned char *p, unsigned int n)
+{
+	unsigned char b;
+
+	b = *(unsigned char*)0x01;
+	__asm__("sei");
+	*(unsigned char*)0x01 = 0x34;
+	memcpy(&farmem[s][o], p, n);
+	*(unsigned char*)0x01 = b;
+	__asm__("cli");
+	return 1;
+}
+
+// copy n bytes from offset o of slot s to p
+void __fastcall__ farget(SLOTTYPE s, unsigned int o, unsigned char *p, unsigned int n)
+{
+	unsigned char b;
+
+	b = *(unsigned char*)0x01;
+	__asm__("sei");
+	*(unsigned char*)0x01 = 0x34;
+	memcpy(p, &farmem[s][o], n);
+	*(unsigned char*)0x01 = b;
+	__asm__("cli");
+}
+#endif
+
+#ifdef PACK
+/*
+  far store in main memory, with the blocks packed: a block is runs of
+  literal bytes and copies of up to 34 bytes from at most 1024 back in
+  the block. a token below $80 is followed by that many literals plus
+  one, one from $80 up is %1lllllhh followed by a byte lo, a copy of
+  l+3 bytes from hhlo+1 back. a block unpacks in one pass with nothing
+  but byte copies, so reaching text in far store stalls for one block
+  at a time. a block that does not get shorter is kept as it is.
+
+  the packed blocks share packpool as the slots do the far store: the
+  front stack's grow up from the start, the back stack's down from the
+  end. a block only goes to far store if its packed form fits between
+  the two, so the slots are no longer what limits the text, the pool is.
+
+  on the C64 the pool is all the heap there is at start but PACKKEEP,
+  taken first so that it sits at the bottom. the line index comes next,
+  with room for the window's lines, and the buffer last, with the whole
+  window, so the buffer is at the top of the heap and grows in place,
+  with the cut buffer in it. the window is smaller than with the other
+  far stores, as what it holds is not packed.
+  estimated, not measured on a cl65 build: with H the heap main.prg
+  has, main.prg opens about 0.95*H of text (the line index takes the
+  rest), main-pack.prg about 4k of window plus 1.7 times H-4k-PACKKEEP
+  of pool, if the far store code and tables take 4k. that is more from
+  H = 27k up, e.g. 31k against 28.5k for H = 30k.
+*/
+static unsigned char *packpool;
+static unsigned int packsize;
+static unsigned int packoff[FARSLOTS],packlen[FARSLOTS];
+static unsigned char packtmp[FARBLOCK + FARBLOCK/128 + 1];
+static unsigned int packhash[256];      // last position of 3 chars, plus 1
+static unsigned char *packq;            // end of what is packed to packtmp
+
+// takes the pool, returns the number of slots
+SLOTTYPE __fastcall__ farinit(void)
+{
+	TRACE("farinit")
+#ifdef __CC65__
+	packsize = _heapmaxavail();
+	packsize = (packsize > PACKKEEP) ? (packsize - PACKKEEP) : 0;
+#else
+	packsize = PACKPOOL;
+#endif
+	if(!(packpool = (unsigned char *)malloc(packsize))) packsize = 0;
+	return FARSLOTS;
+}
+
+// add the n literals at p to packtmp
+void __fastcall__ packlit(unsigned char *p, unsigned int n)
+{
+	if(!n) return;
+	*packq++ = n - 1;
+	memcpy(packq, p, n);
+	packq += n;
+}
+
+// pack n bytes from p to packtmp, returns the packed length, n if that
+// is no shorter
+unsigned int __fastcall__ pack(unsigned char *p, unsigned int n)
+{
+	unsigned int i,c,h,m,lit;
+
+	TRACE("pack")
+	memset(packhash, 0, sizeof(packhash));
+	packq = packtmp;
+	for(i = lit = 0; i < n; ) {
+		if((i - lit) == 128) {
+			packlit(&p[lit], 128);
+			lit = i;
+		}
+		// the longest copy from the last place the next 3 chars were
+		m = 0;
+		if((i + 3) <= n) {
+			h = (unsigned char)(p[i] ^ (p[i+1] << 2) ^ (p[i+2] << 4));
+			c = packhash[h];
+			packhash[h] = i + 1;
+			if(c-- && ((i - c) <= 1024))
+				for( ; (m < 34) && ((i + m) < n) && (p[c + m] == p[i + m]); ++m) ;
+		}
+		if(m >= 3) {
+			packlit(&p[lit], i - lit);
+			c = i - c - 1;
+			*packq++ = 0x80 | ((m - 3) << 2) | (c >> 8);
+			*packq++ = c;
+			lit = (i += m);
+		} else ++i;
+		if((unsigned int)(packq - packtmp) >= n) return n;
+	}
+	packlit(&p[lit], i - lit);
+	m = packq - packtmp;
+	return (m < n) ? m : n;
+}
+
+// unpack the n bytes of slot s to p
+void __fastcall__ unpack(SLOTTYPE s, unsigned char *p, unsigned int n)
+{
+	unsigned char *q,*e,*m;
+	unsigned char t;
+	unsigned int l;
+
+	TRACE("unpack")
+	q = &packpool[packoff[s]];
+	if(packlen[s] == n) {
+		memcpy(p, q, n);
+		return;
+	}
+	for(e = p + n; p < e; ) {
+		t = *q++;
+		if(t < 0x80) {
+			l = t + 1;
+			memcpy(p, q, l);
+			p += l;
+			q += l;
+		} else {
+			l = ((t >> 2) & 0x1f) + 3;
+			m = p - ((((t & 3) << 8) | *q++) + 1);
+			while(l--) *p++ = *m++;
+		}
+	}
+}
+
+// where the packed block of slot s goes if it takes n bytes, returns
+// packsize if it does not fit
+unsigned int __fastcall__ packplace(SLOTTYPE s, unsigned int n)
+{
+	unsigned int f,b;
+
+	// the free space is between the tops of the two stacks
+	f = farfront ? (packoff[farfront - 1] + packlen[farfront - 1]) : 0;
+	b = farback ? packoff[farslots - farback] : packsize;
+	if(s < (farslots - farback)) {
+		// a front block, farfront may already count it
+		if(s < farfront) f = s ? (packoff[s - 1] + packlen[s - 1]) : 0;
+		return ((b - f) >= n) ? f : packsize;
+	}
+	// a back block, farback counts it already
+	b = (s < (farslots - 1)) ? packoff[s + 1] : packsize;
+	return ((b - f) >= n) ? (b - n) : packsize;
+}
+
+// pack the n bytes at p to slot s, o is always 0. returns 0 if there
+// is no room for them
+BOOLTYPE __fastcall__ farput(SLOTTYPE s, unsigned int o, unsigned char *p, unsigned int n)
+{
+	unsigned int l;
+
+	TRACE("farput")
+	l = pack(p, n);
+	if((o = packplace(s, l)) == packsize) return 0;
+	memcpy(&packpool[o], (l < n) ? packtmp : p, l);
+	packoff[s] = o;
+	packlen[s] = l;
+	return 1;
+}
+
+// unpack slot s to p, o is always 0 and n all of the block
+void __fastcall__ farget(SLOTTYPE s, unsigned int o, unsigned char *p, unsigned int n)
+{
+	o = o;
+	unpack(s, p, n);
+}
+
+// the block of slot s moves to slot d as it is, without packing it again
+void __fastcall__ farmoveslot(SLOTTYPE s, SLOTTYPE d)
+{
+	unsigned int o;
+
+	o = packplace(d, packlen[s]);
+	memmove(&packpool[o], &packpool[packoff[s]], packlen[s]);
+	packoff[d] = o;
+	packlen[d] = packlen[s];
+}
+
+// how much more text far store surely takes, as if it did not pack
+unsigned long __fastcall__ farroom(void)
+{
+	unsigned int f,b;
+
+	f = farfront ? (packoff[farfront - 1] + packlen[farfront - 1]) : 0;
+	b = farback ? packoff[farslots - farback] : packsize;
+	if((b - f) > ((farslots - farfront - farback) * FARBLOCK))
+		return (farslots - farfront - farback) * FARBLOCK;
+	return b - f;
+}
+#endif
+
+#ifdef MMAP
+/*
+  far store as a piece table, for the native build: each slot is a
+  piece, a run of text either in the file as it was loaded, mapped
+  read-only, or in the add buffer, which only ever gets appended to. a
+  piece is kept as its origin, from 0 to mapsize in the file, and on
+  from there in the add buffer. opening a file maps it and makes it the
+  back stack, so all there is to loading is counting the lines, and
+  moving through the text only moves the pieces between the stacks.
+
+  text going back to far store is looked for where it came from first:
+  each piece brought into the window leaves an anchor, the origin of its
+  place in the whole text, which edits move along with the text behind
+  them. only a block that no anchor matches is added, so the add buffer
+  grows with the blocks edited, not with the blocks looked at.
+*/
+static unsigned char *mapbase;          // the file as loaded
+static unsigned long mapsize;
+static unsigned char *addbuf;           // the text put to far store after an edit
+static unsigned long addsize,addalloc;
+static unsigned long pieceorg[FARSLOTS];
+struct stat statbuf;                    // of the file saved over, for its mode
+
+// returns the number of slots
+SLOTTYPE __fastcall__ farinit(void)
+{
+	TRACE("farinit")
+	return FARSLOTS;
+}
+
+// the n chars at origin org, 0 if they are not all in the file or all
+// in the add buffer
+unsigned char * __fastcall__ mapat(unsigned long org, unsigned int n)
+{
+	if(org < mapsize) return (n <= (mapsize - org)) ? &mapbase[org] : 0;
+	org -= mapsize;
+	return ((org < addsize) && (n <= (addsize - org))) ? &addbuf[org] : 0;
+}
+
+// the text at pos came from org
+void __fastcall__ mapanchor(unsigned long pos, unsigned long org)
+{
+	unsigned char i;
+
+	for(i = 0; i < MAPANCHORS; ++i)
+		if((anchorpos[i] == pos) && (anchororg[i] == org)) return;
+	anchorpos[anchornext] = pos;
+	anchororg[anchornext] = org;
+	anchornext = (anchornext + 1) % MAPANCHORS;
+}
+
+// the n chars at p in the window go to slot s, as the piece they came
+// from where an anchor finds them, added to the add buffer if not. o is
+// always 0. returns 0 if there is no memory to add them
+BOOLTYPE __fastcall__ farput(SLOTTYPE s, unsigned int o, unsigned char *p, unsigned int n)
+{
+	unsigned long pos,org;
+	unsigned char i;
+	unsigned char *q;
+
+	TRACE("farput")
+	o = p - buffer;
+	if(o >= gapstart) o -= gaplen;
+	pos = TEXTPOS(o);
+	for(i = 0; i < MAPANCHORS; ++i) {
+		org = anchororg[i] + (pos - anchorpos[i]);
+		if((q = mapat(org, n)) && !memcmp(q, p, n)) break;
+	}
+	if(i == MAPANCHORS) {
+		if((addsize + n) > addalloc) {
+			for(org = addalloc ? addalloc : (FARBLOCK*4); org < (addsize + n); org <<= 1) ;
+			if(!(q = realloc(addbuf, org))) return 0;
+			addbuf = q;
+			addalloc = org;
+		}
+		memcpy(&addbuf[addsize], p, n);
+		org = mapsize + addsize;
+		addsize += n;
+	}
+	pieceorg[s] = org;
+	return 1;
+}
+
+// copy the piece of slot s to p, o is always 0 and n all of it
+void __fastcall__ farget(SLOTTYPE s, unsigned int o, unsigned char *p, unsigned int n)
+{
+	o = o;
+	memcpy(p, mapat(pieceorg[s], n), n);
+	// pullfront() and pullback() took it off its stack already
+	if(s == farfront) mapanchor(winbase - n, pieceorg[s]);
+	if(s == (farslots - farback - 1)) mapanchor(TEXTPOS(bufsize), pieceorg[s]);
+}
+
+// the piece of slot s moves to slot d
+void __fastcall__ farmoveslot(SLOTTYPE s, SLOTTYPE d)
+{
+	pieceorg[d] = pieceorg[s];
+}
+
+// end of the piece of m starting at o: FARBLOCK on, back to a line start
+// if there is one, as spillback() cuts them
+unsigned long __fastcall__ mapcut(unsigned char *m, unsigned long o, unsigned long size)
+{
+	unsigned long e;
+
+	if((size - o) <= FARBLOCK) return size;
+	for(e = o + FARBLOCK; (e > o) && (m[e - 1] != '\n'); --e) ;
+	return (e > o) ? e : (o + FARBLOCK);
+}
+
+// map the file as the back stack of an empty text. returns 0 if it
+// cannot be mapped, or has NULs, which insertfile() drops
+BOOLTYPE __fastcall__ mapfile(char *filename)
+{
+	struct stat st;
+	unsigned char *m,*q;
+	unsigned long o,e,size;
+	SLOTTYPE k,s;
+	int fd;
+
+	TRACE("mapfile")
+	if((fd = open(filename, O_RDONLY)) < 0) return 0;
+	m = MAP_FAILED;
+	if(!fstat(fd, &st) && (st.st_size > 0))
+		m = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(m == MAP_FAILED) return 0;
+	size = st.st_size;
+	for(k = 0, o = 0; (o < size) && (k <= farslots); ++k) o = mapcut(m, o, size);
+	if((k > farslots) || memchr(m, 0, size)) {
+		munmap(m, size);
+		return 0;
+	}
+	mapbase = m;
+	mapsize = size;
+	// the first piece goes on top
+	for(s = farslots - k, o = 0; o < size; ++s, o = e) {
+		e = mapcut(m, o, size);
+		pieceorg[s] = o;
+		farlen[s] = e - o;
+		for(farnl[s] = 0, q = &m[o]; (q = memchr(q, '\n', &m[e] - q)); ++q) ++farnl[s];
+	}
+	farback = k;
+	winafter = size;
+	return 1;
+}
+#endif
+
+// position c after the window moved by d chars, clamped to the window
+unsigned int __fastcall__ farpos(unsigned int c, int d)
+{
+	if((d < 0) && (c < (unsigned int)(-d))) return 0;
+	c += d;
+	return (c > bufsize) ? bufsize : c;
+}
+
+// the text moved by d chars in the window, fix up the positions
+void __fastcall__ farshift(int d)
+{
+	unsigned int c;
+
+	TRACE("farshift")
+	Cursor = farpos(Cursor, d);
+	refpos = farpos(refpos, d);
+	c = farpos(scrtop, d);
+	if(c != (scrtop + d)) {
+		scrlost = ((d < 0) && (scrtop < (unsigned int)(-d))) ? -1 : 1;
+		setref(REFSCR);
+	}
+	scrtop = c;
+	c = farpos(cutpoint, d);
+	if(selactive && (c != (cutpoint + d))) {
+		selactive = 0;
+		message("Mark dropped", 1);
+	}
+	cutpoint = c;
+	rowsvalid = geomvalid = 0;
+	colmarks = 0;
+}
+
+// move up to n chars from the start of the window to the front stack
+void __fastcall__ spillfront(unsigned int n)
+{
+	unsigned int o,e,l;
+
+	TRACE("spillfront")
+	if(gapstart < n) movegap(n);
+	for(o = 0; (o < n) && ((farfront + farback) < farslots); o = e) {
+		e = n - o;
+		if(e > FARBLOCK) e = FARBLOCK;
+		e += o;
+		// end the block at a line start if there is one in it
+		if(e < bufsize) {
+			l = lineof(e);
+			if(linestart(l) > o) e = linestart(l);
+		}
+		if(!farput(farfront, 0, &buffer[o], e - o)) break;
+		farlen[farfront] = e - o;
+		farnl[farfront++] = lineof(e) - lineof(o);
+	}
+	// the text in front of the gap moves down, so do its lines
+	l = lineof(o);
+	memmove(buffer, &buffer[o], gapstart - o);
+	linefront -= l;
+	for(e = 0; e < linefront; ++e) lineidx[e] = lineidx[e + l] - o;
+	gapstart -= o;
+	gaplen += o;
+	bufsize -= o;
+	winbase += o;
+	winlines += l;
+	farshift(-(int)o);
+}
+
+// move up to n chars from the end of the window to the back stack
+void __fastcall__ spillback(unsigned int n)
+{
+	unsigned int s,e,l,i,c;
+
+	TRACE("spillback")
+	if(gapstart > (bufsize - n)) movegap(bufsize - n);
+	for(e = bufsize; ((bufsize - e) < n) && ((farfront + farback) < farslots); e = s) {
+		s = n - (bufsize - e);
+		if(s > FARBLOCK) s = FARBLOCK;
+		s = e - s;
+		// start the block at a line start if there is one in it
+		l = lineof(s);
+		if((linestart(l) != s) && (l < LINECOUNT) && (linestart(l+1) < e))
+			s = linestart(l+1);
+		++farback;
+		if(!farput(farslots - farback, 0, &buffer[s + gaplen], e - s)) {
+			--farback;
+			break;
+		}
+		farlen[farslots - farback] = e - s;
+		farnl[farslots - farback] = lineof(e) - lineof(s);
+	}
+	// the lines behind e leave the index, the others move up and
+	// get closer to the end
+	l = LINECOUNT - lineof(e);
+	s = bufsize - e;
+	lineback -= l;
+	for(i = linealloc - 1, c = lineback; c; --i, --c) lineidx[i] = lineidx[i - l] - s;
+	// the text behind the gap moves up to the end of the buffer
+	memmove(&buffer[gapstart + gaplen + s], &buffer[gapstart + gaplen], e - gapstart);
+	gaplen += s;
+	bufsize = e;
+	winafter += s;
+	farshift(0);
+}
+
+// bring the top block of the front stack back to the start of the window
+BOOLTYPE __fastcall__ pullfront(void)
+{
+	unsigned int n,l,c,i;
+
+	TRACE("pullfront")
+	n = farlen[farfront - 1];
+	l = farnl[farfront - 1];
+	if(!setbufsize(bufsize + n) || !setlinesize(LINECOUNT + l)) return 0;
+	--farfront;
+	memmove(&buffer[n], buffer, gapstart);
+	farget(farfront, 0, buffer, n);
+	// lines in front of the gap move up by n, the block's go first
+	memmove(&lineidx[l], lineidx, linefront * sizeof(unsigned int));
+	for(i = l; i < (linefront + l); ++i) lineidx[i] += n;
+	for(c = i = 0; c < n; ++c) if(buffer[c] == '\n') lineidx[i++] = c + 1;
+	linefront += l;
+	gapstart += n;
+	gaplen -= n;
+	bufsize += n;
+	winbase -= n;
+	winlines -= l;
+	farshift(n);
+	return 1;
+}
+
+// bring the top block of the back stack back to the end of the window
+BOOLTYPE __fastcall__ pullback(void)
+{
+	unsigned int n,l,c,i;
+	SLOTTYPE s;
+
+	TRACE("pullback")
+	s = farslots - farback;
+	n = farlen[s];
+	l = farnl[s];
+	if(!setbufsize(bufsize + n) || !setlinesize(LINECOUNT + l)) return 0;
+	--farback;
+	// rows showing the end of the window have to be drawn again
+	if(!rowsvalid || (rowstart[LINES-1] > bufsize)) setref(REFSCR);
+	memmove(&buffer[gapstart + gaplen - n], &buffer[gapstart + gaplen], bufsize - gapstart);
+	farget(s, 0, &buffer[bufalloc - n], n);
+	// lines behind the gap get n chars further from the end, the
+	// block's go on top of them
+	for(i = linealloc - lineback; i < linealloc; ++i) lineidx[i - l] = lineidx[i] + n;
+	for(c = 0, i = linealloc - l; c < n; ++c)
+		if(buffer[bufalloc - n + c] == '\n') lineidx[i++] = n - c - 1;
+	lineback += l;
+	gaplen -= n;
+	bufsize += n;
+	winafter -= n;
+	rowsvalid = 0;
+	return 1;
+}
+
+// move the top block of one stack to the other, the window must be empty
+void __fastcall__ farmove(unsigned char toback)
+{
+	SLOTTYPE s,d;
+
+	TRACE("farmove")
+	if(toback) {
+		s = --farfront;
+		d = farslots - ++farback;
+		winbase -= farlen[s];
+		winlines -= farnl[s];
+		winafter += farlen[s];
+	} else {
+		s = farslots - farback--;
+		d = farfront++;
+		winbase += farlen[s];
+		winlines += farnl[s];
+		winafter -= farlen[s];
+	}
+#if defined(PACK) || defined(MMAP)
+	farmoveslot(s, d);
+#else
+	// the gap is big enough to hold a block on the way
+	farget(s, 0, &buffer[gapstart], farlen[s]);
+	farput(d, 0, &buffer[gapstart], farlen[s]);
+#endif
+	farlen[d] = farlen[s];
+	farnl[d] = farnl[s];
+}
+
+/*
+  slide the window so it holds FARMARGIN chars on either side of pos
+  (counted from the start of the whole text) and no more than FARWINDOW
+  chars where the mark and the top of the screen allow. returns pos as
+  window offset.
+*/
+// number of the line pos is on in the window, blocks spilled from the
+// start of the window keep it whole unless it is the first line, and
+// blocks spilled from the end unless it is the last
+unsigned int __fastcall__ farlineof(unsigned long pos)
+{
+	TRACE("farlineof")
+	if(pos < winbase) return 0;
+	if(pos > (winbase + bufsize)) return LINECOUNT;
+	return lineof(pos - winbase);
+}
+
+// true when the line at c may not be all in the window. farfit() brings
+// in the whole line, so this is only when it does not fit in memory
+BOOLTYPE __fastcall__ farpart(unsigned int c)
+{
+	unsigned int l;
+
+	TRACE("farpart")
+	l = lineof(c);
+	return (farfront && !l) || (farback && (l == LINECOUNT));
+}
+
+unsigned int __fastcall__ farfit(unsigned long pos)
+{
+	unsigned int n;
+
+	TRACE("farfit")
+	// for a jump the window goes to far store as a whole, then blocks
+	// are handed from one stack to the other until pos is close
+	if(pos < winbase) {
+		spillback(bufsize);
+		if(!bufsize)
+			while(farfront && ((winbase - farlen[farfront - 1]) > pos)) farmove(1);
+	} else if(pos > (winbase + bufsize)) {
+		spillfront(bufsize);
+		if(!bufsize)
+			while(farback && ((winbase + farlen[farslots - farback]) < pos)) farmove(0);
+	}
+
+	// bring in text close to pos, making room on the other side first
+	for(;;) {
+		if(farfront && (pos < (winbase + FARMARGIN))) {
+			if(((bufsize + farlen[farfront - 1]) > FARWINDOW) &&
+			   ((winbase + bufsize) >= (pos + FARMARGIN + FARBLOCK)) &&
+			   (farlineof(pos) < LINECOUNT) &&
+			   (!selactive || ((cutpoint + FARBLOCK) <= bufsize)))
+				spillback(FARBLOCK);
+			if(!pullfront()) break;
+		} else if(farback && ((pos + FARMARGIN) > (winbase + bufsize))) {
+			if(((bufsize + farlen[farslots - farback]) > FARWINDOW) &&
+			   (pos >= (winbase + FARMARGIN + FARBLOCK)) && farlineof(pos) &&
+			   (scrtop >= FARBLOCK) && (!selactive || (cutpoint >= FARBLOCK)))
+				spillfront(FARBLOCK);
+			if(!pullback()) break;
+		} else break;
+	}
+
+	// keep the window small, dropping text far away from pos
+	while((bufsize > FARWINDOW) && ((farfront + farback) < farslots)) {
+		n = bufsize;
+		if((pos >= (winbase + FARMARGIN + FARBLOCK)) && (scrtop >= FARBLOCK) &&
+		    farlineof(pos) && (!selactive || (cutpoint >= FARBLOCK)))
+			spillfront(FARBLOCK);
+		else if(((winbase + bufsize) >= (pos + FARMARGIN + FARBLOCK)) &&
+		        (farlineof(pos) < LINECOUNT) &&
+		        (!selactive || ((cutpoint + FARBLOCK) <= bufsize)))
+			spillback(FARBLOCK);
+		else break;
+		// far store is full
+		if(bufsize == n) break;
+	}
+
+	// and fill it up again from behind, then from the front
+	while(farback && ((bufsize + farlen[farslots - farback]) <= FARWINDOW) && pullback()) ;
+	while(farfront && ((bufsize + farlen[farfront - 1]) <= FARWINDOW) && pullfront()) ;
+
+	// the screen can show a page of lines below pos, however long
+	if((pos >= winbase) && (pos <= (winbase + bufsize)))
+		while(farback && ((lineof(pos - winbase) + LINES) > LINECOUNT) && pullback()) ;
+
+	// and the whole line pos is on, so line commands never work on part
+	// of it. the window only starts or ends inside a line when a block
+	// had no line start to be cut at, so that line is long
+	if((pos >= winbase) && (pos <= (winbase + bufsize))) {
+		while(farfront && !lineof(pos - winbase) && pullfront()) ;
+		while(farback && (lineof(pos - winbase) == LINECOUNT) && pullback()) ;
+		if(farpart(pos - winbase)) message("Line too long for memory",0);
+	}
+
+	// with the old top of screen gone, findpos() scrolls from the side
+	// it was on, just as it would for the whole text in memory. the
+	// first line in the window can be cut short, so that is not the top
+	if(scrlost) {
+		if(scrlost > 0) scrtop = bufsize;
+		else scrtop = (winbase && LINECOUNT) ? linestart(1) : 0;
+		scrlost = 0;
+	}
+
+	if(pos < winbase) return 0;
+	if(pos > (winbase + bufsize)) return bufsize;
+	return pos - winbase;
+}
+
+// go back to pos, with the screen from top again if that is still in the window
+unsigned int __fastcall__ farreturn(unsigned long pos, unsigned long top)
+{
+	unsigned int c;
+
+	TRACE("farreturn")
+	c = farfit(pos);
+	if((top >= winbase) && (top <= (winbase + bufsize))) {
+		scrtop = findbol(top - winbase);
+		rowsvalid = geomvalid = 0;
+		setref(REFSCR);
+	}
+	return c;
+}
+
+#ifndef PACK
+// how much more text far store takes
+unsigned long __fastcall__ farroom(void)
+{
+	return (unsigned long)(farslots - farfront - farback) * FARBLOCK;
+}
+#endif
+
+// bring line l (counted from the start of the whole text) into the
+// window, returns its number in the window
+unsigned int __fastcall__ farline(unsigned int l)
+{
+	unsigned long pos;
+	unsigned int n;
+	SLOTTYPE s;
+
+	TRACE("farline")
+	pos = winbase;
+	n = winlines;
+	if((l <= n) && pos) {
+		// walk down the front stack to the block the line starts in,
+		// the window can start in the middle of line l
+		for(s = farfront; s && (n >= l); ) {
+			--s;
+			pos -= farlen[s];
+			n -= farnl[s];
+		}
+		farfit(pos);
+	} else if(l >= (n + LINECOUNT)) {
+		// or up the back stack, the window can end in the middle of line l
+		pos += bufsize;
+		n += LINECOUNT;
+		for(s = farslots - farback; (s < farslots) && ((n + farnl[s]) < l); ++s) {
+			pos += farlen[s];
+			n += farnl[s];
+		}
+		farfit(pos);
+	}
+	// then the whole of line l, the window can be cut inside it
+	if((l >= winlines) && ((l - winlines) <= LINECOUNT))
+		farfit(winbase + linestart(l - winlines));
+	return (l < winlines) ? 0 : (l - winlines);
+}
+
+#endif
+
+// prompt for user input
+int __fastcall__ ask(char *prompt, char *buf, int siz) {
+	int r,c,k,first,i;
+
 	TRACE("ask")
 	r = 0;
 
@@ -792,6 +2314,7 @@ int __fastcall__ ask(char *prompt, char *buf, int siz) {
 		disp_cursor();
 
 //		refresh(); /* empty! */
+		IDLE();
 		k = cgetc();
 
 		switch(k) {
@@ -833,17 +2356,66 @@ int __fastcall__ ask(char *prompt, char *buf, int siz) {
 
 // return keycode for last key
 // this function also takes care of refreshing the screen
+/*
+  keys typed ahead are all done before the screen is brought up to date,
+  so the editor keeps up with auto-repeat and text pasted into it. a key
+  read ahead that is not part of a run is kept in keyback for getkey().
+  a run is at most KEYRUN keys, so with far store it stays in the text
+  farfit() keeps in memory.
+*/
+KEYTYPE keyback;
+BOOLTYPE keyahead;
+
 KEYTYPE __fastcall__ getkey(void)
 {
+	int sc;
+
 	TRACE("getkey")
-	// update screen
-	refrscr();
+#ifdef FARSTORE
+	// keep the text around the cursor in memory
+	Cursor = farfit(winbase + Cursor);
+#endif
+	// update screen, unless there are more keys to do first, then
+	// only keep it on the cursor so the commands see where it is
+	if(keyahead || kbhit()) {
+		// the rows scrolled add up, so the screen still scrolls once
+		// when they are few
+		if((sc = findpos(Cursor))) {
+			keyroll += sc;
+			refstate |= REFROLL;
+			if((keyroll <= -(LINES-1)) || (keyroll >= (LINES-1))) {
+				setref(REFSCR);
+				keyroll = 0;
+			}
+		}
+	} else {
+		refrscr();
+		gotoxy(col,row);
+		disp_cursor();
+	}
+	if(keyahead) {
+		keyahead = 0;
+		return keyback;
+	}
 	// get char
-	gotoxy(col,row);
-    disp_cursor();
+	IDLE();
 	return((KEYTYPE)cgetc());
 }
 
+// how often k was pressed, counting the same keys waiting behind it
+unsigned int __fastcall__ keyrun(KEYTYPE k)
+{
+	unsigned int n;
+
+	TRACE("keyrun")
+	for(n = 1; (n < KEYRUN) && !keyahead && kbhit(); ++n)
+		if((keyback = cgetc()) != k) {
+			keyahead = 1;
+			break;
+		}
+	return n;
+}
+
 /*
 	subroutines for editor commands
 */
@@ -900,6 +2472,351 @@ BOOLTYPE __fastcall__ down(void)
 	return (1);
 }
 
+// move n lines up or down in one step, same as n calls to up()/down()
+void __fastcall__ moveup(unsigned int n)
+{
+	unsigned int l;
+#ifdef FARSTORE
+	unsigned int c;
+#endif
+
+	TRACE("moveup")
+	l = lineof(Cursor);
+#ifdef FARSTORE
+	// lines above the window are fetched from far store first, the
+	// column has to be known before the cursor can drop out of it.
+	// the first line in the window can be cut short, so it counts too
+	if(farpart(Cursor)) {
+		message("Line too long for memory",1);
+		return;
+	}
+	if((n >= l) && winbase) {
+		// newcol() would work out a column 0 again from the cursor,
+		// which means another place once the window has moved
+		c = ccol ? ccol : colof(findbol(Cursor), Cursor);
+		l += winlines;
+		if(n > l) {
+			message("At top of file",1);
+			n = l;
+		}
+		if(n) Cursor = colpos(linestart(farline(l - n)), c);
+		ccol = c;
+		return;
+	}
+#endif
+	if(n > l) {
+		message("At top of file",1);
+		n = l;
+	}
+	if(n) Cursor = newcol(linestart(l - n));
+}
+
+void __fastcall__ movedown(unsigned int n)
+{
+	unsigned int l;
+#ifdef FARSTORE
+	unsigned int c;
+	unsigned long pos;
+#endif
+
+	TRACE("movedown")
+	l = lineof(Cursor);
+#ifdef FARSTORE
+	// and so are lines below it, and the last one in the window
+	if(farpart(Cursor)) {
+		message("Line too long for memory",1);
+		return;
+	}
+	if((n >= (LINECOUNT - l)) && winafter) {
+		c = ccol ? ccol : colof(findbol(Cursor), Cursor);
+		pos = winbase + Cursor;
+		l += winlines;
+		n = farline(l + n);
+		ccol = c;
+		if(n > LINECOUNT) {
+			message("At bottom of file",1);
+			n = LINECOUNT;
+			if((winlines + n) == l) {
+				Cursor = pos - winbase;
+				return;
+			}
+		}
+		Cursor = colpos(linestart(n), c);
+		return;
+	}
+#endif
+	if(n > (LINECOUNT - l)) {
+		message("At bottom of file",1);
+		n = LINECOUNT - l;
+	}
+	if(n) Cursor = newcol(linestart(l + n));
+}
+
+// after a page up or down, the top of screen goes the same number of
+// lines as the cursor did, so it stays on its row and the new page is
+// drawn once instead of scrolled to
+void __fastcall__ pagetop(void)
+{
+	unsigned int l;
+#ifdef FARSTORE
+	unsigned long pos;
+#endif
+
+	TRACE("pagetop")
+	l = lineof(Cursor);
+#ifdef FARSTORE
+	// the top line can be the first in the window, cut short by it, so
+	// it is fetched as a whole. the cursor is put back after that, the
+	// window keeps the top of screen and a page below it
+	if((l <= row) && winbase) {
+		pos = TEXTPOS(Cursor);
+		l += winlines;
+		scrtop = linestart(farline((l > row) ? l - row : 0));
+		rowsvalid = 0;
+		Cursor = farfit(pos);
+		setrows();
+		geomvalid = 0;
+		setref(REFSCR);
+		return;
+	}
+#endif
+	l = linestart((l > row) ? l - row : 0);
+	if(l == scrtop) return;
+	scrtop = l;
+	setrows();
+	geomvalid = 0;
+	setref(REFSCR);
+}
+
+// go to line n (counted from 1)
+void __fastcall__ gotoline(unsigned int n)
+{
+	TRACE("gotoline")
+#ifdef FARSTORE
+	// bring the line into the window, where lines count from its start
+	if(n > 1) {
+		n = farline(n - 1);
+		if(n > LINECOUNT) {
+			message("At bottom of file",1);
+			n = LINECOUNT;
+		}
+		// not with movedown(), line 0 of the window can be cut short
+		Cursor = 0;
+		Cursor = newcol(linestart(n));
+		return;
+	}
+	Cursor = farfit(0);
+#else
+	Cursor = 0;
+	if(n > 1) movedown(n - 1);
+#endif
+}
+
+/*
+  undo journal: every edit goes into the ring undobuf[] as a record of
+  its kind, where in the whole text it was, the chars inserted or deleted
+  and their count again at the end, so the ring can be walked both ways.
+  the records from undofirst to undolast can be undone, the undoredo
+  bytes from there to undoend redone. when the ring is full the oldest
+  records are dropped. all records of one command are one step, typed
+  chars go on in the record before as long as they follow it.
+  a text longer than UNDOCOPY is not copied: one in the cut buffer (a cut
+  or a paste) is kept as its offset there, until the cut buffer is filled
+  again, and an insert as no text at all, it can be undone but not
+  redone. so no single edit is too big for the history.
+  UNDOCOPY is no more than FARMARGIN, so with the window fitted to the
+  position of a record all its text is in the window, a longer delete is
+  done a window at a time.
+*/
+#define UNDOINS  1
+#define UNDODEL  2
+#define UNDOKIND 3
+#define UNDOREF  0x10           /* the text is in the cut buffer */
+#define UNDOBARE 0x20           /* the text is not kept */
+#define UNDOJOIN 0x80           /* undone together with the record before */
+#define UNDOLOST 0x40           /* undojoin: the step did not fit, not kept */
+
+#define UNDOCOPY (UNDOSIZE/2)   /* longest text copied into the ring */
+
+typedef struct {
+	unsigned char kind;
+	POSTYPE pos;
+	unsigned int len;
+} UNDOHDR;
+
+#define UNDORECSIZE(l) (sizeof(UNDOHDR) + (l) + sizeof(unsigned int))
+#define UNDOKEPT(h)    (((h).kind & UNDOREF) ? sizeof(unsigned int) : \
+                        (((h).kind & UNDOBARE) ? 0 : (h).len))
+#define UNDOFWD(o,n)   ((((o) + (n)) >= UNDOSIZE) ? ((o) + (n) - UNDOSIZE) : ((o) + (n)))
+#define UNDOBACK(o,n)  (((o) >= (n)) ? ((o) - (n)) : ((o) + UNDOSIZE - (n)))
+
+static unsigned char undobuf[UNDOSIZE];
+unsigned int undofirst,undolast,undoend,undofill,undoredo;
+unsigned int undostep;          // start of the step being made
+unsigned int undotyped;         // start of the record typing goes on in
+unsigned char undomerge,undojoin,undoing;
+BOOLTYPE undorefs;              // records point into the cut buffer
+
+// copy n bytes from p into the ring at o, returns the offset behind them
+unsigned int __fastcall__ undoput(unsigned int o, void *p, unsigned int n)
+{
+	unsigned int c;
+
+	c = UNDOSIZE - o;
+	if(c > n) c = n;
+	memcpy(&undobuf[o], p, c);
+	memcpy(undobuf, (unsigned char*)p + c, n - c);
+	return UNDOFWD(o, n);
+}
+
+// copy n bytes at o from the ring to p
+void __fastcall__ undoget(unsigned int o, void *p, unsigned int n)
+{
+	unsigned int c;
+
+	c = UNDOSIZE - o;
+	if(c > n) c = n;
+	memcpy(p, &undobuf[o], c);
+	memcpy((unsigned char*)p + c, undobuf, n - c);
+}
+
+void __fastcall__ undoclear(void)
+{
+	TRACE("undoclear")
+	undofirst = undolast = undoend = 0;
+	undofill = undoredo = 0;
+	undomerge = 0;
+	undorefs = 0;
+}
+
+// make room for n bytes behind undolast, what could be redone goes first
+BOOLTYPE __fastcall__ undospace(unsigned int n)
+{
+	static UNDOHDR h;
+	unsigned int l;
+
+	TRACE("undospace")
+	undoend = undolast;
+	undofill -= undoredo;
+	undoredo = 0;
+	while(undofill) {
+		undoget(undofirst, &h, sizeof(h));
+		// the records of a step are dropped together, but not the step
+		// being made
+		if(!(h.kind & UNDOJOIN) && (((UNDOSIZE - undofill) >= n) ||
+		   (undojoin && (undofirst == undostep)))) break;
+		if(undofirst == undotyped) undomerge = 0;
+		l = UNDORECSIZE(UNDOKEPT(h));
+		undofirst = UNDOFWD(undofirst, l);
+		undofill -= l;
+	}
+	// with no room for the step the whole history goes, with the rest of it
+	if((UNDOSIZE - undofill) < n) {
+		undoclear();
+		undojoin = UNDOLOST;
+		message("Undo history lost", 1);
+		return 0;
+	}
+	return 1;
+}
+
+// journal n chars at p inserted or deleted at window offset c
+void __fastcall__ undorecord(unsigned char kind, unsigned int c, unsigned char *p, unsigned int n)
+{
+	static UNDOHDR h;
+	static unsigned int o;
+	unsigned int k;
+
+	TRACE("undorecord")
+	if(undoing || !n || (undojoin == UNDOLOST)) return;
+	k = n;
+	if(n > UNDOCOPY) {
+		if((p >= cutbuffer) && (p < (cutbuffer + cutbufsize))) {
+			kind |= UNDOREF;
+			o = p - cutbuffer;
+			p = (unsigned char*)&o;
+			k = sizeof(o);
+			undorefs = 1;
+		} else if(kind == UNDOINS) {
+			kind |= UNDOBARE;
+			k = 0;
+		}
+	}
+	if(!undospace(UNDORECSIZE(k))) return;
+	if(!undojoin) undostep = undoend;
+	h.kind = kind | undojoin;
+	h.pos = TEXTPOS(c);
+	h.len = n;
+	undotyped = undoend;
+	undoend = undoput(undoend, &h, sizeof(h));
+	undoend = undoput(undoend, p, k);
+	undoend = undoput(undoend, &k, sizeof(k));
+	undolast = undoend;
+	undofill += UNDORECSIZE(k);
+	undomerge = 0;
+	undojoin = UNDOJOIN;
+}
+
+// journal the n chars at p typed at window offset c
+void __fastcall__ undotype(unsigned int c, unsigned char *p, unsigned int n)
+{
+	static UNDOHDR h;
+	BOOLTYPE m;
+
+	TRACE("undotype")
+	if(undoing || (undojoin == UNDOLOST)) return;
+	m = 0;
+	if(undomerge && !undojoin && !undoredo) {
+		undoget(undotyped, &h, sizeof(h));
+		m = ((h.pos + h.len) == TEXTPOS(c)) && undospace(n) && undomerge;
+	}
+	if(m) {
+		// the count at the end of the record moves up by the new chars
+		h.len += n;
+		undoput(undotyped, &h, sizeof(h));
+		undoend = undoput(UNDOBACK(undoend, sizeof(h.len)), p, n);
+		undoend = undoput(undoend, &h.len, sizeof(h.len));
+		undolast = undoend;
+		undofill += n;
+		undostep = undotyped;
+		undojoin = UNDOJOIN;
+	} else undorecord(UNDOINS, c, p, n);
+	// a new line ends the record
+	undomerge = (p[n-1] != '\n');
+}
+
+// the cut buffer is filled again: the records pointing into it go, with
+// the history before them, and what could be redone
+void __fastcall__ undocutgone(void)
+{
+	static UNDOHDR h;
+	unsigned int o,l,e,n;
+
+	TRACE("undocutgone")
+	if(!undorefs) return;
+	undoend = undolast;
+	undofill -= undoredo;
+	undoredo = 0;
+	// e is how much of the ring is up to the end of the last of them
+	for(o = undofirst, e = n = 0; n < undofill; n += l) {
+		undoget(o, &h, sizeof(h));
+		l = UNDORECSIZE(UNDOKEPT(h));
+		o = UNDOFWD(o, l);
+		if(h.kind & UNDOREF) e = n + l;
+	}
+	// the rest of the step of the last one goes too
+	while(undofill) {
+		undoget(undofirst, &h, sizeof(h));
+		if(!e && !(h.kind & UNDOJOIN)) break;
+		if(undofirst == undotyped) undomerge = 0;
+		l = UNDORECSIZE(UNDOKEPT(h));
+		undofirst = UNDOFWD(undofirst, l);
+		undofill -= l;
+		e = (e > l) ? (e - l) : 0;
+	}
+	undorefs = 0;
+}
+
 void __fastcall__ startselect(void)
 {
 	TRACE("startselect")
@@ -911,19 +2828,23 @@ void __fastcall__ startselect(void)
 // type one char at cursor position, fast version of "insert"
 void __fastcall__ type(unsigned char ch)
 {
-unsigned char *buf = buffer;
-//unsigned int c;
-
 	TRACE("type")
 
 	if(!setbufsize(bufsize+1)) return;
+	if((ch == '\n') && !setlinesize(LINECOUNT+1)) return;
 	setref(REFEOL);
-//	for(c = bufsize; c >= (Cursor + 1); c--) buf[c] = buf[c-1];
-	memmove(&buf[Cursor+1],&buf[Cursor],(bufsize-Cursor));
+	movegap(Cursor);
+	undotype(Cursor, &ch, 1);
 
 	if(cutpoint > Cursor) ++cutpoint;
-	buf[Cursor++] = ch;
-	if(ch == '\n') setref(REFEOS);
+	buffer[gapstart++] = ch;
+	--gaplen;
+	++bufsize;
+	geominsert(Cursor++, 1, (ch == '\n'));
+	if(ch == '\n') {
+		lineidx[linefront++] = gapstart;
+		setref(REFEOS);
+	}
 	ccol = 0;
 	modified = 1;
 }
@@ -931,23 +2852,31 @@ unsigned char *buf = buffer;
 
 //void __fastcall__ insert(unsigned char *k, int l) {
 void insert(unsigned char *k, int l) {
-unsigned char *buf = buffer;
-unsigned int c;
+unsigned int c,n;
 
 	TRACE("insert")
 
-	if(!setbufsize(bufsize+l))
+	for(c = n = 0; c < l; ++c) if(k[c] == '\n') ++n;
+	if(!setbufsize(bufsize+l) || !setlinesize(LINECOUNT+n))
     {
          return;
     }
 	setref(REFEOL);
-//	for(c = bufsize; c >= (Cursor + l); c--) buf[c] = buf[c-l];
-	memmove(&buf[Cursor+l],&buf[Cursor],(bufsize-Cursor));
+	movegap(Cursor);
+	undorecord(UNDOINS, Cursor, k, l);
 	if(cutpoint > Cursor) cutpoint += l;
+	memcpy(&buffer[gapstart],k,l);
+	bufsize += l;
+	gaplen -= l;
+	geominsert(Cursor, l, n);
 	for(c = 0; c < l; ++c)
     {
-		buf[Cursor++] = k[c];
-		if(k[c] == '\n') setref(REFEOS);
+		++Cursor;
+		++gapstart;
+		if(k[c] == '\n') {
+			lineidx[linefront++] = gapstart;
+			setref(REFEOS);
+		}
 	}
 	ccol = 0;
 	modified = 1;
@@ -956,29 +2885,53 @@ unsigned int c;
 // delete N chars at cursor position
 void __fastcall__ cur_delete(unsigned int n)
 {
-	unsigned int c;
-	unsigned char *buf = buffer;
+	unsigned int c,nl;
 
 	TRACE("cur_delete")
 	setref(REFEOL);
 	if(n > (bufsize - Cursor)) n = bufsize - Cursor;
-	for(c = Cursor; c<Cursor+n; ++c) if(buf[c] == '\n') setref(REFEOS);
-
-//	for(c = Cursor; c+n < bufsize; c++) buf[c] = buf[c+n];
-	memmove(&buf[Cursor],&buf[Cursor+n],(bufsize-(Cursor+n)));
-
+	for(c = Cursor, nl = 0; c<Cursor+n; ++c) if(BUFAT(c) == '\n') {
+		setref(REFEOS);
+		++nl;
+	}
+	geomdelete(Cursor, n, nl);
+
+	// deleting at the gap just widens it
+	movegap(Cursor);
+	undorecord(UNDODEL, Cursor, &buffer[gapstart+gaplen], n);
+	while(lineback && ((bufsize - lineidx[linealloc - lineback]) <= (gapstart + n)))
+		--lineback;
+	gaplen += n;
 	bufsize -= n;
 	if(cutpoint > Cursor) cutpoint -= n;
 	ccol = 0;
 	modified = 1;
 }
 
+// move the text from the cursor to e to the end of the cut buffer
+BOOLTYPE __fastcall__ cutout(unsigned int e)
+{
+	unsigned int n,o;
+
+	TRACE("cutout")
+	o = cutbufsize;
+	n = e - Cursor;
+	if(!setcutbufsize(o + n)) return 0;
+	// with the gap at the cursor the cut text is in one piece behind it
+	movegap(Cursor);
+	memcpy(&cutbuffer[o], &buffer[gapstart+gaplen], n);
+	// journalled with the text where it is in the cut buffer now
+	undorecord(UNDODEL, Cursor, &cutbuffer[o], n);
+	undoing = 1;
+	cur_delete(n);
+	undoing = 0;
+	return 1;
+}
+
 // cuts text from mark to cursor position
 void __fastcall__ cut(void)
 {
 	unsigned int c;
-//	,d;
-	unsigned char *buf = buffer;
 
 	TRACE("cut")
 	if(!selactive) {
@@ -991,28 +2944,63 @@ void __fastcall__ cut(void)
 		Cursor = c;
 	}
 	if(cutpoint > bufsize) cutpoint = bufsize;
-	if(!setcutbufsize(cutpoint-Cursor)) return;
-
-// call to stdlib might be faster and saves a variable here
-//	for(c = Cursor,d = 0; c < cutpoint;) cutbuffer[d++] = buf[c++];
-	memmove(&cutbuffer[0],&buf[Cursor],(cutpoint-Cursor));
-
-//	gotoxy(0,0);cprintf("%04x %d",&cutbuffer[0],(cutpoint-Cursor));
-
-	cur_delete(cutpoint-Cursor);
+	undocutgone();
+	cutbufsize = 0;
+	if(!cutout(cutpoint)) return;
 	cutpoint = Cursor;
 	selactive = 0;
 	modified = 1;
 }
 
+// delete to the end of the line, or the newline there. what goes is cut,
+// a run of them is cut together
 void __fastcall__ deleol(void) {
+	unsigned int e;
+
 	TRACE("deleol")
-	if(buffer[Cursor] == '\n') cur_delete(1);
-	else {
-		startselect();
-		Cursor = findeol(Cursor);
-		cut();
+#ifdef FARSTORE
+	// never cut part of a line
+	if(farpart(Cursor)) {
+		message("Line too long for memory",1);
+		return;
+	}
+#endif
+	e = findeol(Cursor);
+	if((e == Cursor) && (e < bufsize)) ++e;
+	if(!cutmore) {
+		undocutgone();
+		cutbufsize = 0;
+	}
+	cutmore = cutout(e);
+}
+
+// type k and the printable keys waiting behind it in one insert
+void __fastcall__ typeahead(KEYTYPE k)
+{
+	static unsigned char run[COLS];
+	unsigned char n;
+	unsigned int c,b;
+
+	TRACE("typeahead")
+	run[0] = k;
+	for(n = 1; (n < COLS) && !keyahead && kbhit(); ++n)
+		if(!isprint(run[n] = cgetc())) {
+			keyback = run[n];
+			keyahead = 1;
+			break;
+		}
+	if(n == 1) {
+		type(k);
+		return;
 	}
+	// the run is journalled as typed, so it goes on in the record of
+	// the keys typed before it and the ones after
+	c = Cursor;
+	b = bufsize;
+	undoing = 1;
+	insert(run, n);
+	undoing = 0;
+	if(bufsize != b) undotype(c, run, n);
 }
 
 void __fastcall__ paste(void)
@@ -1020,20 +3008,203 @@ void __fastcall__ paste(void)
 /* unsigned int c,l; */
 
 	TRACE("paste")
+	// making room for the text may move the cut buffer
+	if(!setbufsize(bufsize + cutbufsize)) return;
 	insert(cutbuffer, cutbufsize);
 }
 
+// insert the text of the record h at o, from the undo ring, where it may
+// wrap around, or from the cut buffer
+BOOLTYPE __fastcall__ undotext(unsigned int o, UNDOHDR *h)
+{
+	unsigned int c,b,n;
+
+	TRACE("undotext")
+	b = bufsize;
+	n = h->len;
+	o = UNDOFWD(o, sizeof(UNDOHDR));
+	if(h->kind & UNDOREF) {
+		undoget(o, &c, sizeof(c));
+		// making room for the text may move the cut buffer
+		if(setbufsize(bufsize + n)) insert(&cutbuffer[c], n);
+	} else {
+		c = UNDOSIZE - o;
+		if(c > n) c = n;
+		insert(&undobuf[o], c);
+		if(n > c) insert(undobuf, n - c);
+	}
+	return (bufsize == (b + n));
+}
+
+// take back the edit of the record at o, or make it again
+BOOLTYPE __fastcall__ undoapply(unsigned int o, UNDOHDR *h, BOOLTYPE again)
+{
+	BOOLTYPE ok;
+	unsigned int n,c;
+
+	TRACE("undoapply")
+	undoing = 1;
+	Cursor = farfit(h->pos);
+	ok = 1;
+	if(((h->kind & UNDOKIND) == UNDOINS) == again) ok = undotext(o, h);
+	else {
+		// a text longer than the window goes a window at a time
+		for(n = h->len; n; n -= c) {
+			Cursor = farfit(h->pos);
+			if(!(c = bufsize - Cursor)) break;
+			if(c > n) c = n;
+			cur_delete(c);
+		}
+	}
+	undoing = 0;
+	// without memory for the text the history no longer fits it
+	if(!ok) undoclear();
+	return ok;
+}
+
+// undo the last step
+void __fastcall__ undo(void)
+{
+	static UNDOHDR h;
+	unsigned int n,o;
+
+	TRACE("undo")
+	undomerge = 0;
+	if(undofill == undoredo) {
+		message("Nothing to undo", 1);
+		return;
+	}
+	do {
+		undoget(UNDOBACK(undolast, sizeof(n)), &n, sizeof(n));
+		o = UNDOBACK(undolast, UNDORECSIZE(n));
+		undoget(o, &h, sizeof(h));
+		if(!undoapply(o, &h, 0)) return;
+		undolast = o;
+		undoredo += UNDORECSIZE(n);
+	} while((h.kind & UNDOJOIN) && (undofill != undoredo));
+}
+
+// redo the step undone last
+void __fastcall__ redo(void)
+{
+	static UNDOHDR h;
+	unsigned int o,n,l;
+
+	TRACE("redo")
+	undomerge = 0;
+	if(!undoredo) {
+		message("Nothing to redo", 1);
+		return;
+	}
+	// an insert kept without its text cannot be made again, nor can
+	// anything after it
+	for(o = undolast, n = 0; n < undoredo; n += l) {
+		undoget(o, &h, sizeof(h));
+		if(n && !(h.kind & UNDOJOIN)) break;
+		if(h.kind & UNDOBARE) {
+			undoend = undolast;
+			undofill -= undoredo;
+			undoredo = 0;
+			message("Too long to redo", 1);
+			return;
+		}
+		l = UNDORECSIZE(UNDOKEPT(h));
+		o = UNDOFWD(o, l);
+	}
+	undoget(undolast, &h, sizeof(h));
+	do {
+		if(!undoapply(undolast, &h, 1)) return;
+		undolast = UNDOFWD(undolast, UNDORECSIZE(UNDOKEPT(h)));
+		undoredo -= UNDORECSIZE(UNDOKEPT(h));
+		if(!undoredo) break;
+		undoget(undolast, &h, sizeof(h));
+	} while(h.kind & UNDOJOIN);
+}
+
+/*
+  Boyer-Moore-Horspool skip tables, for the string last searched for.
+  findskip[] is how far a forward search can move on by the char under
+  the last pattern position, findrskip[] the same for a reverse search
+  by the char under the first one.
+*/
+static char findkey[32];
+static unsigned char findskip[256],findrskip[256];
+
+// searches compare chars through fold[], which maps both cases of a
+// letter to one when case is ignored
+static unsigned char fold[256];
+unsigned char ignorecase;
+
+void __fastcall__ setfold(void)
+{
+	unsigned int i;
+
+	TRACE("setfold")
+	for(i = 0; i < 256; ++i) fold[i] = ignorecase ? tolower(i) : i;
+	// the skip tables depend on it
+	findkey[0] = 0;
+}
+
+// build the skip tables for f, unless they are there already
+void __fastcall__ setskip(char *f, int l)
+{
+	int i;
+
+	TRACE("setskip")
+	if(!strcmp(f, findkey)) return;
+	// a key too long to keep is set up again every time
+	if(l < (int)sizeof(findkey)) strcpy(findkey, f);
+	else findkey[0] = 0;
+	memset(findskip, l, sizeof(findskip));
+	memset(findrskip, l, sizeof(findrskip));
+	for(i = 0; i < (l-1); ++i) findskip[fold[(unsigned char)f[i]]] = l-1-i;
+	for(i = l-1; i > 0; --i) findrskip[fold[(unsigned char)f[i]]] = i;
+}
+
+// does f match the l chars at p
+BOOLTYPE __fastcall__ findmatch(char *f, unsigned char *p, int l)
+{
+	if(!ignorecase) return !memcmp(f, p, l);
+	while(l--) if(fold[(unsigned char)*f++] != fold[*p++]) return 0;
+	return 1;
+}
+
 unsigned int __fastcall__ find(char *f)
 {
 unsigned int c;
 int l;
+unsigned char *p;
+#ifdef FARSTORE
+unsigned long start,end,top;
+#endif
 
 	TRACE("find")
 	if(!(*f)) return Cursor;
 	l = strlen(f);
+	setskip(f, l);
+#ifdef FARSTORE
+	start = winbase + Cursor;
+	top = winbase + scrtop;
+#endif
 
-	for(c = Cursor+1; c + l < bufsize; ++c)
-		if(!memcmp(f, &buffer[c], l)) return c;
+	for(;;) {
+		// all candidates lie behind the cursor, so with the gap there they
+		// can be compared in one piece
+		movegap(Cursor);
+		p = &buffer[gaplen];
+		for(c = Cursor+1; c + l < bufsize; c += findskip[fold[p[c+l-1]]])
+			if(findmatch(f, &p[c], l)) return c;
+#ifdef FARSTORE
+		// go on behind the window, from the first candidate not tried
+		end = winbase + bufsize;
+		if(farback) {
+			Cursor = farfit(winbase + c) - 1;
+			if((winbase + bufsize) > end) continue;
+		}
+		Cursor = farreturn(start, top);
+#endif
+		break;
+	}
 
 	message("Not found",1);
 	return Cursor;
@@ -1041,31 +3212,296 @@ int l;
 
 unsigned int __fastcall__ findreverse(char *f)
 {
-	unsigned int c;
+	unsigned int c,d;
 	int l;
+#ifdef FARSTORE
+	unsigned long start,end,top;
+#endif
 
 	TRACE("find")
 	if(!(*f)) return Cursor;
 	l = strlen(f);
+	setskip(f, l);
+#ifdef FARSTORE
+	start = winbase + Cursor;
+	top = winbase + scrtop;
+#endif
 
-	if(Cursor) for(c = Cursor-1;;) {
-		if(!memcmp(f, &buffer[c], l)) return c;
-		if(!c--) break;
+	for(;;) {
+		if(Cursor && (l <= bufsize)) {
+			// start at the last candidate that still fits into the text
+			c = bufsize - l;
+			if(c >= Cursor) c = Cursor-1;
+			// with the gap behind it all candidates are in front of the gap
+			movegap(c + l);
+			for(;;) {
+				if(findmatch(f, &buffer[c], l)) return c;
+				if(c < (d = findrskip[fold[buffer[c]]])) break;
+				c -= d;
+			}
+		}
+#ifdef FARSTORE
+		// go on in front of the window
+		end = winbase;
+		if(farfront) {
+			Cursor = farfit(winbase);
+			if(winbase < end) continue;
+		}
+		Cursor = farreturn(start, top);
+#endif
+		break;
 	}
 
 	message("Not found",1);
 	return Cursor;
 }
 
+/*
+  incremental find: each char typed extends the match from the last hit,
+  or searches on from there if it no longer matches. hits[] holds the
+  hit for each length of f so DEL can go back to it, the first g chars
+  of f are the ones found. RETURN or any other command key ends the
+  search at the hit, Ctrl/C goes back to where it started.
+*/
+void __fastcall__ isearch(char *f)
+{
+	static POSTYPE hits[32];
+	POSTYPE h;
+	static char prompt[COLS];
+	unsigned int c,l,g;
+	KEYTYPE k;
+
+	TRACE("isearch")
+	hits[0] = TEXTPOS(Cursor);
+	l = g = 0;
+	*f = 0;
+	for(;;) {
+		// the end of f is shown if it is too long for the status line
+		strcpy(prompt, (g < l) ? "Failing: " : "Find: ");
+		c = (COLS-19) - strlen(prompt);
+		strcat(prompt, (l > c) ? &f[l-c] : f);
+		message(prompt, 0);
+		ccol = 0;
+		k = getkey();
+		switch(k) {
+#if !(BKSP == DEL)
+		case BKSP:
+#endif
+		case DEL:
+			if(l) f[--l] = 0;
+			if(g > l) g = l;
+			Cursor = farfit(hits[l]);
+			break;
+		case ABORT:
+			Cursor = farfit(hits[0]);
+			setref(REFSTA);
+			return;
+		default:
+			if(!isprint(k) || (l == 31)) {
+				setref(REFSTA);
+				return;
+			}
+			h = hits[l];
+			f[l] = k;
+			f[++l] = 0;
+			hits[l] = h;
+			if(g < (l-1)) break;
+			// the match may still hold where it is, else look on from there
+			Cursor = c = farfit(h);
+			movegap(c);
+			if(((c + l) <= bufsize) && findmatch(f, &buffer[c+gaplen], l)) g = l;
+			else if(TEXTPOS(Cursor = find(f)) != h) {
+				hits[l] = TEXTPOS(Cursor);
+				g = l;
+			}
+			break;
+		}
+	}
+}
+
+/*
+  replace all matches of f from s to the end of the window by the cut
+  buffer. with the gap at s the text behind it is copied down to the
+  front in one pass, putting in the cut buffer for each match. if the
+  text grows the matches are counted first to make room. the positions
+  in pos[] move with the text around them. adds the number replaced to
+  *total, *next is the first position not tried yet, as the text is now.
+  in far store the window grows by FARMARGIN at most, the matches after
+  that are left for the next call, once the window has moved on. returns
+  0 if there is no room for the text.
+*/
+BOOLTYPE __fastcall__ replwindow(char *f, unsigned int s, POSTYPE *pos, unsigned int *next, unsigned long *total)
+{
+	unsigned int c,r,w,n,m,l,nf,nr,i;
+	unsigned int x[3];
+	unsigned char pend[3];
+	unsigned long add;
+	unsigned char *p;
+
+	TRACE("replwindow")
+	l = strlen(f);
+	for(c = nf = 0; c < l; ++c) if(f[c] == '\n') ++nf;
+	for(c = nr = 0; c < cutbufsize; ++c) if(cutbuffer[c] == '\n') ++nr;
+	movegap(s);
+	m = (unsigned int)~0;
+	if((cutbufsize > l) || (nr > nf)) {
+		p = &buffer[gaplen];
+		for(n = 0, c = s; c + l <= bufsize; )
+			if(findmatch(f, &p[c], l)) {
+#ifdef FARSTORE
+				if(n && (cutbufsize > l) &&
+				   (((unsigned long)(n + 1) * (cutbufsize - l)) > FARMARGIN)) {
+					m = n;
+					break;
+				}
+#endif
+				++n;
+				c += l;
+			} else c += findskip[fold[p[c+l-1]]];
+		add = (cutbufsize > l) ? (unsigned long)n * (cutbufsize - l) : 0;
+		// the text in memory has to stay within an unsigned int
+		if((bufsize + add) > (unsigned int)~15) {
+			message("Insufficient memory", 1);
+			return 0;
+		}
+		if(!setbufsize(bufsize + (unsigned int)add) ||
+		   !setlinesize(LINECOUNT + ((nr > nf) ? (n * (nr - nf)) : 0)))
+			return 0;
+	}
+
+	// the positions in the part to be done are followed as it is copied,
+	// those behind the window move by what it grew or shrank
+	for(i = 0; i < 3; ++i) {
+		pend[i] = (pos[i] >= TEXTPOS(s)) && (pos[i] <= TEXTPOS(bufsize));
+		if(pend[i]) x[i] = pos[i] - TEXTPOS(0);
+		else if(pos[i] > TEXTPOS(bufsize)) pend[i] = 2;
+	}
+
+	// r reads behind the gap, w writes in front of it and stays behind r
+	p = &buffer[gaplen];
+	for(n = 0, r = w = c = s; (n < m) && (c + l <= bufsize); ) {
+		if(!findmatch(f, &p[c], l)) {
+			c += findskip[fold[p[c+l-1]]];
+			continue;
+		}
+		for(i = 0; i < 3; ++i)
+			if((pend[i] == 1) && (x[i] < (c + l))) {
+				pos[i] = TEXTPOS(((x[i] < c) ? x[i] : c) - r + w);
+				pend[i] = 0;
+			}
+		memmove(&buffer[w], &p[r], c - r);
+		w += c - r;
+		memcpy(&buffer[w], cutbuffer, cutbufsize);
+		w += cutbufsize;
+		r = c = c + l;
+		++n;
+	}
+	*next = c - r + w;
+	memmove(&buffer[w], &p[r], bufsize - r);
+	w += bufsize - r;
+	for(i = 0; i < 3; ++i) {
+		if(pend[i] == 1) pos[i] = TEXTPOS(x[i] - r + (w - (bufsize - r)));
+		else if(pend[i]) pos[i] = pos[i] - TEXTPOS(bufsize) + TEXTPOS(w);
+	}
+
+	// everything is in front of the gap now, so are all the lines
+	lineback = 0;
+	for(c = s; c < w; ++c) if(buffer[c] == '\n') lineidx[linefront++] = c + 1;
+	gapstart = w;
+	gaplen = bufalloc - w;
+	bufsize = w;
+	*total += n;
+	return 1;
+}
+
+// replace all matches of f in the text by the cut buffer
+void __fastcall__ replaceall(char *f)
+{
+	static POSTYPE pos[3];
+	unsigned int s,c,l;
+	unsigned long total;
+	BOOLTYPE ok;
+#ifdef FARSTORE
+	unsigned char *p;
+#endif
+
+	TRACE("replaceall")
+	if(!(*f)) return;
+	l = strlen(f);
+	setskip(f, l);
+	pos[0] = TEXTPOS(Cursor);
+	pos[1] = TEXTPOS(cutpoint);
+	pos[2] = TEXTPOS(scrtop);
+	total = 0;
+	ok = 1;
+#ifdef FARSTORE
+	// if the text grows it has to fit in far store once it has, else
+	// nothing is replaced, as when it does not fit in memory without
+	if(cutbufsize > l) {
+		s = farfit(0);
+		for(;;) {
+			movegap(s);
+			p = &buffer[gaplen];
+			for(c = s; (c + l) <= bufsize; )
+				if(findmatch(f, &p[c], l)) {
+					++total;
+					c += l;
+				} else c += findskip[fold[p[c+l-1]]];
+			s = farfit(winbase + c);
+			if((s + l) > bufsize) break;
+		}
+		if((total * (cutbufsize - l)) > farroom()) ok = 0;
+		total = 0;
+	}
+#endif
+	if(ok) {
+		s = farfit(0);
+		while((ok = replwindow(f, s, pos, &c, &total))) {
+#ifdef FARSTORE
+			// go on from the first candidate not tried, in this window
+			// if it was left for later, or in the next one
+			s = farfit(winbase + c);
+			if((s + l) <= bufsize) continue;
+#endif
+			break;
+		}
+	}
+
+	// the screen and everything worked out from the text has to be redone
+#ifdef FARSTORE
+	Cursor = farreturn(pos[0], pos[2]);
+	// the mark may not be in the window any more
+	if((pos[1] < winbase) || (pos[1] > TEXTPOS(bufsize))) {
+		selactive = 0;
+		pos[1] = TEXTPOS(Cursor);
+	}
+#else
+	Cursor = pos[0];
+	scrtop = findbol(pos[2]);
+#endif
+	cutpoint = pos[1] - TEXTPOS(0);
+	rowsvalid = geomvalid = 0;
+	colmarks = 0;
+	setref(REFSCR);
+	ccol = 0;
+	if(total) {
+		modified = 1;
+		// the replacements are not journalled, so what was before is gone
+		undoclear();
+	}
+	// with no room in one window the rest is left as it is
+	sprintf(scrbuf, ok ? "%lu replaced" : "Insufficient memory, %lu replaced", total);
+	message(scrbuf, !ok);
+}
+
 void __fastcall__ justify(void)
 {
-unsigned char *buf = buffer;
 	unsigned c, i;
 
 	Cursor = findeol(Cursor);
 	if(Cursor >= bufsize) return;
-	for(Cursor--; Cursor > 0 && (buf[Cursor] == ' ' ||
-				     buf[Cursor]==TABCODE); --Cursor) cur_delete(1);
+	for(Cursor--; Cursor > 0 && (BUFAT(Cursor) == ' ' ||
+				     BUFAT(Cursor)==TABCODE); --Cursor) cur_delete(1);
 	++Cursor;
 	c = findbol(Cursor);
 	if(c == Cursor) {
@@ -1076,13 +3512,15 @@ unsigned char *buf = buffer;
 	newcol(Cursor);
 	if(ccol < 72) {
 		if(Cursor >= bufsize) return;
-		if(buf[Cursor+1] == '\n') {
+		if((Cursor+1 >= bufsize) || (BUFAT(Cursor+1) == '\n')) {
 			++Cursor;
 			return;
 		}
-		buf[Cursor++] = ' ';
+		cur_delete(1);
+		type(' ');
 		setref(REFSCR);
-		for(i = 0; buf[Cursor+i] == ' ' || buf[Cursor+i] == TABCODE;  ++i);
+		for(i = 0; (Cursor+i < bufsize) &&
+			(BUFAT(Cursor+i) == ' ' || BUFAT(Cursor+i) == TABCODE);  ++i);
 		if(i) cur_delete(i);
 		ccol = 0;
 		Cursor = findeol(Cursor);
@@ -1094,30 +3532,35 @@ unsigned char *buf = buffer;
 		ccol = 72;
 		Cursor = newcol(findbol(Cursor));
 		for(;; --Cursor) {
-			if(!Cursor || buf[Cursor] == '\n') {
+			if(!Cursor || BUFAT(Cursor) == '\n') {
 				down();
 				break;
 			}
-			if(buf[Cursor] != ' ' && buf[Cursor] != TABCODE)
+			if(BUFAT(Cursor) != ' ' && BUFAT(Cursor) != TABCODE)
 				continue;
-			for(i = 0; Cursor && (buf[Cursor] == ' ' ||
-					 buf[Cursor] == TABCODE); --Cursor) ++i;
+			for(i = 0; Cursor && (BUFAT(Cursor) == ' ' ||
+					 BUFAT(Cursor) == TABCODE); --Cursor) ++i;
 			++Cursor;
 			if(i) cur_delete(i);
 			insert("\n", 1);
 			modified = 1;
 			break;
 		}
-	} else ++Cursor;
+	} else if(Cursor < bufsize) ++Cursor;
 
-	for(i = 0; buf[Cursor+i] == ' ' || buf[Cursor+i] == TABCODE; ++i);
+	for(i = 0; (Cursor+i < bufsize) &&
+		(BUFAT(Cursor+i) == ' ' || BUFAT(Cursor+i) == TABCODE); ++i);
 	if(i) cur_delete(i);
 
-	if(Cursor >= bufsize || buf[Cursor] == '\n') return;
+	if(Cursor >= bufsize || BUFAT(Cursor) == '\n') return;
 
+	// copy the indentation of the previous line, it lies in front of
+	// the cursor so typing it in does not move it
 	c = findbol(Cursor - 1);
-	for(i = 0; buf[c+i] == ' ' || buf[c+i] == TABCODE; ++i);
-	insert(&buf[c], i);
+	for(i = 0; BUFAT(c+i) == ' ' || BUFAT(c+i) == TABCODE; ++i);
+	for(; i; --i, ++c) type(BUFAT(c));
+	ccol = 0;
+	modified = 1;
 
 	Cursor = findeol(Cursor);
 }
@@ -1150,44 +3593,91 @@ char ynbuf[4];
 
 BOOLTYPE __fastcall__ insertfile(char *filename)
 {
-	unsigned int i;
-	//CHARTYPE
-    int k;
+	unsigned int c,d,n,r,l,nl;
+	CHARTYPE ch;
 	FILE *f;
-//	static char buf[INSBUFSIZE];
-CHARTYPE *buf;
+#ifdef FARSTORE
+	unsigned long base;
+#endif
 
-	i = 0;
+	TRACE("insertfile")
+#ifdef MMAP
+	// an empty text takes the file as it is, see mapfile()
+	if(!mapbase && !TEXTSIZE && mapfile(filename)) {
+		setref(REFSCR);
+		selactive = 0;
+		undoclear();
+		Cursor = farfit(0);
+		ccol = 0;
+		modified = 1;
+		return (0);
+	}
+#endif
 	if(f = fopen(filename, "rb"))
     {
-		if(!(buf = (CHARTYPE*) malloc(INSBUFSIZE*sizeof(CHARTYPE))))
-        {
-			message("Insufficent memory", 1);
-			return (1);
-		}
-		showbusy(0);
-		while((k = fgetc(f)) != EOF) if(k)
-        {
-
-//			buf[i++] = k;
-			buf[i] = k; ++i;
-//            gotoxy(2,2+i);cprintf("buf:%x",k);
-			if(i == INSBUFSIZE)
-            {
-				showbusy(1);
-				insert(buf, INSBUFSIZE);
-				showbusy(0);
-				i = 0;
+		setref(REFEOL);
+		movegap(Cursor);
+		l = nl = 0;
+#ifdef FARSTORE
+		base = winbase;
+#endif
+		do {
+#ifdef FARSTORE
+			// only a window of the text stays in memory, what has been
+			// read so far goes to far store when the gap runs low
+			if((gaplen <= FILEBLOCK) && (bufsize >= FARWINDOW)) spillfront(gapstart);
+#endif
+			// grow the buffer by half its size so loading stays linear,
+			// just by one block if there is not enough memory for that
+			if(gaplen <= FILEBLOCK) {
+				n = bufsize >> 1;
+				if(n < FILEBLOCK) n = FILEBLOCK;
+				if(!setbufsize(bufsize+n)) {
+					if(!setbufsize(bufsize+FILEBLOCK)) break;
+					showmessage = 0;
+				}
 			}
+			showbusy(0);
+			n = r = fread(&buffer[gapstart], 1, FILEBLOCK, f);
+			showbusy(1);
+			// drop NULs and index the lines in the same pass
+			for(c = d = gapstart; n; ++c, --n) {
+				if(!(ch = buffer[c])) continue;
+				if(ch == '\n') {
+					if(!setlinesize(LINECOUNT+1)) break;
+					lineidx[linefront++] = d+1;
+					++nl;
+				}
+				buffer[d++] = ch;
+			}
+			d -= gapstart;
+			gapstart += d;
+			gaplen -= d;
+			bufsize += d;
+			l += d;
+		} while((r == FILEBLOCK) && !n);
+		fclose(f);
 
+#ifdef FARSTORE
+		// if the window moved, go to the end of the text read like below
+		if(winbase != base) {
+			setref(REFSCR);
+			selactive = 0;
+			// the journal cannot hold that much anyway
+			undoclear();
+			Cursor = farfit(winbase + gapstart);
+			ccol = 0;
+			modified = 1;
+			return (0);
 		}
-		if(i)
-        {
-//        gotoxy(2,2+i);cprintf("buf:%s",buf);cgetc();
-            insert(buf, i);
-        }
-		fclose(f);
-		free(buf);
+#endif
+		if(cutpoint > Cursor) cutpoint += l;
+		undorecord(UNDOINS, Cursor, &buffer[Cursor], l);
+		geominsert(Cursor, l, nl);
+		if(nl) setref(REFEOS);
+		Cursor += l;
+		ccol = 0;
+		modified = 1;
 	} else {
 		sprintf(scrbuf, "ERROR: could not read %s", filename);
 		message(scrbuf,0);
@@ -1196,13 +3686,62 @@ CHARTYPE *buf;
 	return (0);
 }
 
+// write n bytes from p in blocks, returns the number of bytes written
+unsigned int __fastcall__ writeblock(FILE *f, unsigned char *p, unsigned int n)
+{
+	unsigned int c,w;
+
+	TRACE("writeblock")
+	for(c = 0; c < n; c += w) {
+		w = n - c;
+		if(w > FILEBLOCK) w = FILEBLOCK;
+		showbusy(1);
+		if((w = fwrite(&p[c], 1, w, f)) == 0) break;
+	}
+	return c;
+}
+
+#ifdef FARSTORE
+// write block s of far store to f, returns the number of bytes written
+unsigned int __fastcall__ farwrite(FILE *f, SLOTTYPE s)
+{
+#ifdef PACK
+	// blocks unpack as a whole
+	TRACE("farwrite")
+	farget(s, 0, packtmp, farlen[s]);
+	return writeblock(f, packtmp, farlen[s]);
+#elif defined(MMAP)
+	// pieces go out from where they are
+	TRACE("farwrite")
+	return writeblock(f, mapat(pieceorg[s], farlen[s]), farlen[s]);
+#else
+	static unsigned char page[256];
+	unsigned int o,n;
+
+	TRACE("farwrite")
+	for(o = 0; o < farlen[s]; o += n) {
+		n = farlen[s] - o;
+		if(n > sizeof(page)) n = sizeof(page);
+		farget(s, o, page, n);
+		if(writeblock(f, page, n) != n) break;
+	}
+	return o;
+#endif
+}
+#endif
+
 BOOLTYPE __fastcall__ writefile(char *filename)
 {
 	FILE *f /*, *fb*/;
 	static char backupfile[255];
 	char *dot /*, *c*/;
-	int notnew, bytes;
-	unsigned int i;
+	int notnew;
+#ifdef FARSTORE
+	unsigned long bytes;
+	SLOTTYPE s;
+#else
+	unsigned int bytes;
+#endif
 
 	notnew = 1;
 	if((f = fopen(filename, "r")) && notnew)
@@ -1220,9 +3759,8 @@ BOOLTYPE __fastcall__ writefile(char *filename)
 			if(lstat(filename, &statbuf) ||
 			   rename(filename, backupfile))
             {
-				gotoxy( 0,(LINES-1));
-				cputs("ERROR: could not make backup ");
-				cputs(backupfile);
+				sprintf(scrbuf, "ERROR: could not make backup %s", backupfile);
+				message(scrbuf,1);
 				return 0;
 			}
 		} else notnew = 0;
@@ -1236,11 +3774,23 @@ BOOLTYPE __fastcall__ writefile(char *filename)
 		return (0);
 	}
 	bytes = 0;
-	for(i = 0; i < bufsize; ++i) {
-		fputc(buffer[i], f);
-		++bytes;
-	}
+#ifdef FARSTORE
+	// the blocks in front of the window come first
+	for(s = 0; s < farfront; ++s) bytes += farwrite(f, s);
+#endif
+	// text in front of the gap, then the text behind it
+	bytes += writeblock(f, buffer, gapstart);
+	bytes += writeblock(f, &buffer[gapstart+gaplen], bufsize-gapstart);
+#ifdef FARSTORE
+	for(s = farslots - farback; s < farslots; ++s) bytes += farwrite(f, s);
+#endif
 	fclose(f);
+	if(bytes != TEXTSIZE)
+    {
+		sprintf(scrbuf, "ERROR: could not write %s", filename);
+		message(scrbuf,0);
+		return (0);
+	}
 
 	if(notnew)
     {
@@ -1248,14 +3798,201 @@ BOOLTYPE __fastcall__ writefile(char *filename)
 		chown(filename, statbuf.st_uid, statbuf.st_gid);
 	}
 
-	gotoxy(0,LINES-1);
-	cclear(COLS-wherex());
-	sprintf(scrbuf,"%s %d bytes", filename, bytes);
+	if(!batchmode) {
+		gotoxy(0,LINES-1);
+		cclear(COLS-wherex());
+	}
+	sprintf(scrbuf,"%s %lu bytes", filename, (unsigned long)bytes);
 	message(scrbuf, 0);
 	modified = 0;
 	return (1);
 }
 
+#ifdef PROFILE
+// the slot with the most cycles not yet in done, 0 when none is left
+unsigned char __fastcall__ proftop(unsigned char *done)
+{
+	unsigned char i, best;
+
+	for(best = 0, i = 1; i < profcount; ++i)
+		if(!done[i] && (!best || (profcycles[i] > profcycles[best]))) best = i;
+	done[best] = 1;
+	return best;
+}
+
+// the functions that took most of the cycles, on the status line
+void __fastcall__ profshow(void)
+{
+	static unsigned char done[PROFSLOTS];
+	static char entry[40];
+	unsigned long total;
+	unsigned char i, n;
+
+	for(total = 0, i = 1; i < profcount; ++i) total += profcycles[i];
+	total = total / 100 + 1;
+	memset(done, 0, sizeof(done));
+	for(*scrbuf = 0, n = 0; (i = proftop(done)) != 0; n += strlen(entry)) {
+		sprintf(entry, "%s%s %lu%%", n ? " " : "", profnames[i], profcycles[i] / total);
+		if((n + strlen(entry)) >= (COLS-1)) break;
+		strcpy(&scrbuf[n], entry);
+	}
+	message(scrbuf, 0);
+}
+
+// the whole table, most cycles first
+void __fastcall__ profdump(char *name)
+{
+	static unsigned char done[PROFSLOTS];
+	FILE *f;
+	unsigned char i;
+
+	if(!(f = fopen(name, "w"))) {
+		message("ERROR: could not write profile", 1);
+		return;
+	}
+	fprintf(f, "%-12s %10s %10s\n", "function", "calls", "cycles");
+	memset(done, 0, sizeof(done));
+	while((i = proftop(done)) != 0)
+		fprintf(f, "%-12s %10lu %10lu\n", profnames[i], profcalls[i], profcycles[i]);
+	fprintf(f, "%-12s %10s %10lu\n", "(keys)", "", profcycles[0]);
+	fclose(f);
+	message("Profile written", 0);
+}
+
+// start counting from here on
+void __fastcall__ profclear(void)
+{
+	memset(profcalls, 0, sizeof(profcalls));
+	memset(profcycles, 0, sizeof(profcycles));
+	message("Profile cleared", 0);
+}
+#endif
+
+/*
+  batch mode, ned -e script file: the script is done on the file with the
+  same functions as the keys, then the file is saved if it changed after
+  it was loaded or last saved.
+  nothing is shown and nothing is kept for undo, so it goes as fast as
+  the edits. a command a line, with the rest of the line as argument, in
+  which \n, \t and \\ stand for newline, tab and \:
+	goto n		go to line n
+	top, bottom	go to the start or end of the text
+	up n, down n	move n lines
+	home, end	go to the start or end of the line
+	find text	find text after the cursor, as Ctrl/F
+	back text	find text before the cursor
+	case		toggle case sensitive find
+	mark		mark start of selection
+	cut		cut from mark to cursor
+	kill		cut to end of line, repeated adds to the cut
+	paste		insert the cut buffer
+	replace		replace the text found last by the cut buffer
+	all text	replace all of text by the cut buffer
+	insert text	insert text at the cursor
+	delete n	delete n chars at the cursor
+	include file	insert file at the cursor
+	save [file]	save now, under another name if given
+  lines that are empty or start with # are skipped. an error, like text
+  not found or a move beyond the end, stops the script unsaved. text to
+  find is up to 31 chars, as at the prompts.
+*/
+int __fastcall__ batch(char *script, char *file)
+{
+	static char line[256];
+	static char found[256];
+	FILE *f;
+	char *cmd, *arg, *p, *q;
+	unsigned int n;
+
+	TRACE("batch")
+	if(!(f = fopen(script, "r"))) {
+		printf("ERROR: could not read %s\n", script);
+		return 1;
+	}
+	batchmode = 1;
+	filename = file;
+	undojoin = UNDOLOST;
+	if(insertfile(filename)) {
+		printf("%s\n", scrbuf);
+		return 1;
+	}
+	Cursor = farfit(0);
+	modified = 0;
+	*found = 0;
+
+	for(n = 1; !batcherr && fgets(line, sizeof(line), f); ++n) {
+		// the command, then its argument with the escapes resolved
+		if((*line == '#') || (*line == '\n')) continue;
+		for(arg = cmd = line; *arg && (*arg != ' ') && (*arg != '\n'); ++arg) ;
+		if(*arg == ' ') *arg++ = 0;
+		for(p = q = arg; *p && (*p != '\n'); ++p, ++q) {
+			if((*p == '\\') && p[1]) switch(*++p) {
+				case 'n': *p = '\n'; break;
+				case 't': *p = TABCODE; break;
+			}
+			*q = *p;
+		}
+		*q = 0;
+
+#ifdef FARSTORE
+		Cursor = farfit(winbase + Cursor);
+#endif
+		// as after a key, with the journal off
+		undojoin = UNDOLOST;
+		if(strcmp(cmd, "kill")) cutmore = 0;
+		// keys no longer than the find prompts take
+		if((!strcmp(cmd, "find") || !strcmp(cmd, "back") || !strcmp(cmd, "all")) &&
+		   (strlen(arg) >= sizeof(findkey)))
+			batcherr = "Find string too long";
+		else if(!strcmp(cmd, "goto")) gotoline(atoi(arg));
+		else if(!strcmp(cmd, "top")) Cursor = farfit(0);
+		else if(!strcmp(cmd, "bottom")) Cursor = farfit(TEXTSIZE);
+		else if(!strcmp(cmd, "up")) moveup(atoi(arg));
+		else if(!strcmp(cmd, "down")) movedown(atoi(arg));
+		else if(!strcmp(cmd, "home")) {
+			Cursor = findbol(Cursor);
+			ccol = 0;
+		} else if(!strcmp(cmd, "end")) {
+			Cursor = findeol(Cursor);
+			ccol = 0;
+		} else if(!strcmp(cmd, "find") || !strcmp(cmd, "back")) {
+			strcpy(found, arg);
+			Cursor = (*cmd == 'f') ? find(found) : findreverse(found);
+			ccol = 0;
+		} else if(!strcmp(cmd, "case")) {
+			ignorecase ^= 1;
+			setfold();
+		} else if(!strcmp(cmd, "mark")) startselect();
+		else if(!strcmp(cmd, "cut")) cut();
+		else if(!strcmp(cmd, "kill")) deleol();
+		else if(!strcmp(cmd, "paste")) paste();
+		else if(!strcmp(cmd, "replace")) {
+			cur_delete(strlen(found));
+			paste();
+		} else if(!strcmp(cmd, "all")) replaceall(arg);
+		else if(!strcmp(cmd, "insert")) insert((unsigned char *)arg, strlen(arg));
+		else if(!strcmp(cmd, "delete")) cur_delete(atoi(arg));
+		else if(!strcmp(cmd, "include")) {
+			if(insertfile(arg)) batcherr = scrbuf;
+		} else if(!strcmp(cmd, "save")) {
+			if(!writefile(*arg ? arg : filename)) batcherr = scrbuf;
+		} else if(*cmd) batcherr = "Unknown command";
+	}
+	fclose(f);
+	if(batcherr) {
+		printf("%s:%u: %s\n", script, n - 1, batcherr);
+		return 1;
+	}
+	if(modified) {
+		if(!writefile(filename)) {
+			printf("%s\n", scrbuf);
+			return 1;
+		}
+		printf("%s\n", scrbuf);
+	}
+	return 0;
+}
+
 /*
    main loop
 */
@@ -1263,10 +4000,10 @@ BOOLTYPE __fastcall__ writefile(char *filename)
 int main(int argc, char **argv) {
 
 //	FILE *f;
-	unsigned int i, j;
+	unsigned int j;
 
 	KEYTYPE k;
-#if sizeof(CHARTYPE) != sizeof(KEYTYPE)
+#if CHARSIZE != KEYSIZE
 	CHARTYPE ch;
 #endif
 
@@ -1282,28 +4019,36 @@ int main(int argc, char **argv) {
 	}
 */
 
-	// init editor globals
+	showmessage=0;
+#ifdef FARSTORE
+	// first, so that a pool taken from the heap is below the buffer
+	if(!(farslots = farinit())) message("No REU found",1);
+#endif
+
+	// init editor globals, the buffer last, so that it can grow in place
+	lineidx=0;
+	setlinesize(0);
 	buffer=cutbuffer=0;
 	setbufsize(0);
 
 	leftmargin = 0;
 	ccol = 0;
-	cutbuffer = 0;
 	cutpoint = 0; selactive = 0;
 	scrtop = Cursor = 0;
 	findbuffer[0] = 0;
 	modified = 0;
 
-	showmessage=0;
-
 	showtabs=1;
+	setfold();
+	// a script to do on the file, without the screen
+	if((argc == 4) && !strcmp(argv[1], "-e")) return batch(argv[2], argv[3]);
+	initscreen();
 	refstate = REFSCR|REFSTA;
 
 	findpos(Cursor);
 
  	filename = "";
 
-/*
 	if(argc != 2 && argc != 3) {
 
 //    	filename = "";
@@ -1312,39 +4057,45 @@ int main(int argc, char **argv) {
 
 		filename = argv[1];
 
+		// the text loaded is where the history starts
+		undojoin = UNDOLOST;
 		insertfile(filename);
+		Cursor = farfit(0);
+		modified = 0;
 
-		if(argc == 3) {
-			j = atoi(argv[2]);
-			for(i = 1; i < j; i++) down();
-		}
+		if(argc == 3) gotoline(atoi(argv[2]));
 
 	}
-*/
 
 	k=0;while(k!=ABORT)
     {
 		// read char from keyboard
 		k = getkey();
+		// all edits of one command are undone as one step
+		undojoin = 0;
+		if(k != DELEOL) cutmore = 0;
 		// check for control commands
 		switch(k) {
+			// a run of the same move is done as one
 			case LEFT:
-				left();
+				for(j = keyrun(LEFT); j && left(); --j) ;
 				break;
 			case UPARR:
-				up();
+				moveup(keyrun(UPARR));
 				break;
 			case DOWN:
-				down();
+				movedown(keyrun(DOWN));
 				break;
 			case RIGHT:
-				right();
+				for(j = keyrun(RIGHT); j && right(); --j) ;
 				break;
 			case PGUP:
-				for(i = 0; i < (LINES-1); ++i) up();
+				moveup((LINES-1) * keyrun(PGUP));
+				pagetop();
 				break;
 			case PGDOWN:
-				for(i = 0; i < (LINES-1); ++i) down();
+				movedown((LINES-1) * keyrun(PGDOWN));
+				pagetop();
 				break;
 			case HOME:
 				Cursor = findbol(Cursor);
@@ -1362,14 +4113,14 @@ int main(int argc, char **argv) {
 			case GOTO:
 				*linbuf = 0;
 				ask("Goto: ", linbuf, 15);
-				if(j = atoi(linbuf)) {
-					Cursor = 0;
-					for(i = 1; i < j; ++i) down();
-				}
+				if(j = atoi(linbuf)) gotoline(j);
 				break;
 			case SELECT:
 				startselect();
 				break;
+			case UNDO:
+				undo();
+				break;
 			case CUT:
 				cut();
 				break;
@@ -1419,7 +4170,7 @@ int main(int argc, char **argv) {
 			case QUOTE:
 				k = getkey();
 //				if(k >= 0 && k < 256) {
-#if sizeof(CHARTYPE) != sizeof(KEYTYPE)
+#if CHARSIZE != KEYSIZE
 					ch = k;
 					insert(&ch, 1);
 #else
@@ -1432,10 +4183,13 @@ int main(int argc, char **argv) {
 			case SHIFT:
 				switch(getkey()) {
 					case PGUP:
-						Cursor = 0;
+						Cursor = farfit(0);
 						break;
 					case PGDOWN:
-						Cursor = bufsize;
+						Cursor = farfit(TEXTSIZE);
+						break;
+					case UNDO:
+						redo();
 						break;
 					case FIND:
 						ask("Reverse find: ", findbuffer, 31);
@@ -1460,6 +4214,30 @@ int main(int argc, char **argv) {
 						paste();
 						Cursor = find(findbuffer);
 						break;
+					case 's':
+						isearch(findbuffer);
+						break;
+					case 'a':
+						replaceall(findbuffer);
+						break;
+					case 'c':
+						ignorecase ^= 1;
+						setfold();
+						message(ignorecase ? "Case ignored" : "Case matters", 0);
+						break;
+#ifdef PROFILE
+					case 'p':
+						profshow();
+						break;
+					case 'd':
+						*filenambuf = 0;
+						ask("Profile to: ", filenambuf, 67);
+						if(*filenambuf) profdump(filenambuf);
+						break;
+					case 'z':
+						profclear();
+						break;
+#endif
 				}
 				break;
 			/* added key for switching display of tab-control characters on/off */
@@ -1472,7 +4250,7 @@ int main(int argc, char **argv) {
 			/* added this one to handle different char/keycode
 		   	and to make the statement below cleaner */
 			case TABKEY:
-#if sizeof(CHARTYPE) != sizeof(KEYTYPE)
+#if CHARSIZE != KEYSIZE
 					ch = TABCODE;
 					insert(&ch, 1);
 #else
@@ -1487,12 +4265,12 @@ int main(int argc, char **argv) {
 			   	(k >= 160 && k < 255) || k == TABCODE) {
 		 	*/
 				if(isprint(k)!=0) {
-#if sizeof(CHARTYPE) != sizeof(KEYTYPE)
+#if CHARSIZE != KEYSIZE
 					ch = k;
 					insert(&ch, 1);
 #else
 //					insert(&k, 1);
-					type(k);
+					typeahead(k);
 #endif
 				}
 				break; /* bug if this break; is missing! */